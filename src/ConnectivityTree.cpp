@@ -8,76 +8,57 @@
  */
 #include "ConnectivityTree.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace syncopa
 {
 
-  ConnectivityNode::ConnectivityNode( nsolMSection_ptr section_ )
-  : _section( section_ )
-  , _sectionLength( 0.0f )
-  , _parent( nullptr )
-  , _maxDepth( 0 )
-  , _deepestChildrenNode( nullptr )
-  , _deepestChild( nullptr )
+  ConnectivityNode::ConnectivityNode( const ConnectivityTree* tree ,
+                                      unsigned int index ,
+                                      nsolMSection_ptr section_ )
+  : _tree( tree )
+  , _index( index )
+  , _section( section_ )
   { }
 
-  void ConnectivityNode::parent( cnode_ptr parent_ )
+  unsigned int ConnectivityNode::index( void ) const
   {
-    _parent = parent_;
+    return _index;
   }
 
   cnode_ptr ConnectivityNode::parent( void ) const
   {
-    return _parent;
+    return _tree->_node( _tree->_parents[ _index ]);
   }
 
-  void ConnectivityNode::sectionLength( float length_ )
-  {
-    _sectionLength = length_;
-  }
-
-  float ConnectivityNode::sectionLength( void ) const
-  {
-    return _sectionLength;
-  }
-
-
-
-//  void ConnectivityNode::checkDeepestBranch( unsigned int depth, cnode_ptr section )
-//  {
-//    if( depth > _maxDepth )
-//    {
-//      _maxDepth = depth;
-//      _deepestChildrenNode = section;
-//    }
-//  }
-
   cnode_ptr ConnectivityNode::deepestBranchNode( void ) const
   {
-    return _deepestChildrenNode;
+    return _tree->_node( _tree->_deepestLeaves[ _index ]);
   }
 
   cnode_ptr ConnectivityNode::deepestChild( void ) const
   {
-    return _deepestChild;
+    return _tree->_node( _tree->_deepestChildren[ _index ]);
   }
 
-  unsigned int ConnectivityNode::childrenMaxDepth( void ) const
+  unsigned int ConnectivityNode::depth( void ) const
   {
-    return _maxDepth;
+    return _tree->_depths[ _index ];
   }
 
-  void ConnectivityNode::initializeInterpolator( const mat4& transform )
+  unsigned int ConnectivityNode::childrenMaxDepth( void ) const
   {
-    if( _section )
-    {
-      for( auto node : _section->nodes( ))
-        _interpolator.insert( transformPoint( node->point( ), transform ));
-    }
+    return _tree->_subtreeDepths[ _index ];
   }
 
-  void ConnectivityNode::section( nsol::NeuronMorphologySectionPtr section_ )
+  bool ConnectivityNode::isAncestorOf( const ConnectivityNode* node ) const
   {
-    _section = section_;
+    if( !node || node->_tree != _tree || node == this )
+      return false;
+
+    return _tree->_tourIn[ _index ] < _tree->_tourIn[ node->_index ] &&
+           _tree->_tourOut[ node->_index ] <= _tree->_tourOut[ _index ];
   }
 
   nsol::NeuronMorphologySectionPtr ConnectivityNode::section( void ) const
@@ -85,244 +66,221 @@ namespace syncopa
     return _section;
   }
 
-  void ConnectivityNode::addChild( cnode_ptr child )
-  {
-    if( _children.empty( ))
-    {
-      _deepestChildrenNode = child;
-      _deepestChild = child;
-      _maxDepth = 1;
-
-      if( _parent )
-      {
-        _propagateDepth( this );
-      }
-    }
-
-    _children.insert( std::make_pair( child->section( ), child ));
-  }
-
   tCNodeVec ConnectivityNode::children( void ) const
   {
     tCNodeVec result;
-    result.reserve( _children.size( ));
+    result.reserve( numberOfChildren( ));
 
-    for( auto child : _children )
-      result.push_back( child.second );
+    for( auto child = _tree->_firstChildren[ _index ];
+         child != ConnectivityTree::invalidIndex;
+         child = _tree->_nextSiblings[ child ])
+      result.push_back( _tree->_node( child ));
 
     return result;
   }
 
   cnode_ptr ConnectivityNode::firstChild( void ) const
   {
-    if( _children.empty( ))
-      return nullptr;
-    else
-      return _children.begin( )->second;
+    return _tree->_node( _tree->_firstChildren[ _index ]);
   }
 
   cnode_ptr ConnectivityNode::lastChild( void ) const
   {
-    if( _children.empty( ))
-      return nullptr;
-    else
-      // Assuming only two children
-      return ( ++_children.begin( ))->second;
+    return _tree->_node( _tree->_lastChildren[ _index ]);
   }
 
   unsigned int ConnectivityNode::numberOfChildren( void ) const
   {
-    return _children.size( );
+    return _tree->_childrenCount[ _index ];
   }
 
-  void ConnectivityNode::_propagateDepth( const cnode_ptr sourceChild )
+  tCNodeVec ConnectivityNode::deepestPath( bool fromRoot ) const
   {
-    unsigned int totalChildDepth = sourceChild->childrenMaxDepth( ) + 1;
+    tCNodeVec result;
+    result.reserve( childrenMaxDepth( ));
 
-//    std::cout << "-propagating depth from " << sourceChild->section( )->id( )
-//              << " old " << _maxDepth
-//              << " new " << totalChildDepth
-//              << std::endl;
+    for( auto child = _tree->_deepestChildren[ _index ];
+         child != ConnectivityTree::invalidIndex;
+         child = _tree->_deepestChildren[ child ])
+      result.push_back( _tree->_node( child ));
 
-    if( totalChildDepth >= _maxDepth  )
-    {
-      _maxDepth = totalChildDepth;
-      _deepestChildrenNode = sourceChild->deepestBranchNode( );
-      _deepestChild = sourceChild;
+    if( !fromRoot )
+      std::reverse( result.begin( ), result.end( ));
 
-      if( _parent )
-        _parent->_propagateDepth( this );
-    }
+    return result;
   }
 
-  void ConnectivityNode::_calculateDeepestPath( void )
+  tCNodeVec ConnectivityNode::allFirstChildren( void ) const
   {
-//    cnode_ptr deepestChild = nullptr;
-//    auto nodeChildren = children( );
-//    while( !nodeChildren.empty( ) )
-//    {
-//
-//      deepestChild = nodeChildren.front( );
-//
-//      if( nodeChildren.size( ) > 1 && deepestChild->childrenMaxDepth( ) >
-//                                      nodeChildren.back( )->childrenMaxDepth( ))
-//      {
-//        deepestChild = nodeChildren.back( );
-//      }
-//
-//      result.push_back( deepestChild );
-//
-//      nodeChildren = deepestChild->children( );
-//    }
-
+    tCNodeVec result;
 
+    for( auto child = _tree->_firstChildren[ _index ];
+         child != ConnectivityTree::invalidIndex;
+         child = _tree->_firstChildren[ child ])
+      result.push_back( _tree->_node( child ));
 
+    return result;
   }
 
-  tCNodeVec ConnectivityNode::deepestPath( bool fromRoot ) const
+  tCNodeVec ConnectivityNode::allChildren( void ) const
   {
     tCNodeVec result;
-//TODO
-    auto currentNode = _deepestChildrenNode;
-
-    while( currentNode && currentNode->section( )->id( ) != _section->id( ))
-    {
-      result.push_back( currentNode );
-
-      currentNode = currentNode->parent( );
-    }
 
-    if( fromRoot )
-      std::reverse( result.begin( ), result.end( ));
+    const auto first = _tree->_tourIn[ _index ] + 1;
+    const auto last = _tree->_tourOut[ _index ];
+    result.reserve( last - first );
 
-//    std::cout  << std::endl << "Calculated deepest path with " << result.size( ) << " sections";
+    for( auto i = first; i < last; ++i )
+      result.push_back( _tree->_node( _tree->_tour[ i ]));
 
     return result;
   }
 
-  tCNodeVec ConnectivityNode::allFirstChildren( void ) const
-  {
-    tCNodeVec result;
 
-    auto nodeChildren = children( );
 
-    std::cout << _section->id( ) << "Nodes ";
+  const unsigned int ConnectivityTree::invalidIndex =
+    std::numeric_limits< unsigned int >::max( );
 
-    while( !nodeChildren.empty( ))
-    {
-      auto node = nodeChildren.front( );
-
-      result.push_back( node );
+  ConnectivityTree::ConnectivityTree(  )
+  : _maxDepth( 0 )
+  { }
 
-      std::cout << " " << node->section( )->id( );
+  unsigned int ConnectivityTree::addBranch( const std::vector< nsolMSection_ptr >& sections )
+  {
+    if( sections.empty( ))
+      return 0;
 
-      nodeChildren = node->children( );
+    // Sections go from the synapse to the soma, nodes are linked from the
+    // root down to the new leaf.
+    unsigned int last = invalidIndex;
+    for( auto sec = sections.rbegin( ); sec != sections.rend( ); ++sec )
+    {
+      auto it = _sectionToNodes.find( *sec );
+      if( it == _sectionToNodes.end( ))
+        last = _addNode( *sec, last );
+      else
+        last = it->second;
     }
 
-    std::cout << std::endl;
-
-    return result;
+    return sections.size( );
   }
 
-  tCNodeVec ConnectivityNode::allChildren( void ) const
+  unsigned int ConnectivityTree::_addNode( nsolMSection_ptr section,
+                                           unsigned int parent )
   {
-    std::queue< cnode_ptr > pendingNodes;
+    const auto index = static_cast< unsigned int >( _nodes.size( ));
 
-    tCNodeVec result;
+    _nodes.emplace_back( this, index, section );
 
-    for( auto child : _children )
-      pendingNodes.push( child.second );
+    _parents.push_back( parent );
+    _firstChildren.push_back( invalidIndex );
+    _lastChildren.push_back( invalidIndex );
+    _nextSiblings.push_back( invalidIndex );
+    _childrenCount.push_back( 0 );
 
-    while( !pendingNodes.empty( ))
+    if( parent == invalidIndex )
+      _rootNodes.push_back( &_nodes.back( ));
+    else
     {
-      auto current = pendingNodes.front( );
-      auto children = current->children( );
-      for( auto child : children )
-        pendingNodes.push( child );
-
-      result.push_back( current );
+      if( _lastChildren[ parent ] == invalidIndex )
+        _firstChildren[ parent ] = index;
+      else
+        _nextSiblings[ _lastChildren[ parent ]] = index;
 
-      pendingNodes.pop( );
+      _lastChildren[ parent ] = index;
+      _childrenCount[ parent ] += 1;
     }
 
-    return result;
-  }
-
+    _sectionToNodes.insert( std::make_pair( section, index ));
+    _sectionIDToNodes.insert( std::make_pair( section->id( ), &_nodes.back( )));
 
+    return index;
+  }
 
-  ConnectivityTree::ConnectivityTree(  )
-  : _size( 0 )
-  , _maxDepth( 0 )
-  { }
-
-  unsigned int ConnectivityTree::addBranch( const std::vector< nsolMSection_ptr >& sections )
+  void ConnectivityTree::finalize( void )
   {
+    const auto count = _nodes.size( );
 
-//    std::cout << this << " Adding branch of " << sections.size( ) << " sections" << std::endl;
+    _depths.assign( count, 0 );
+    _subtreeDepths.assign( count, 0 );
+    _deepestChildren.assign( count, invalidIndex );
+    _deepestLeaves.assign( count, invalidIndex );
+    _tourIn.assign( count, 0 );
+    _tourOut.assign( count, 0 );
 
-    if( sections.empty( ))
-      return 0;
+    _tour.clear( );
+    _tour.reserve( count );
+    _leafNodes.clear( );
 
-    auto rootSection = sections.back( );
+    // Preorder traversal, keeping the insertion order of the children.
+    std::vector< unsigned int > pending;
+    std::vector< unsigned int > children;
+    for( auto root = _rootNodes.rbegin( ); root != _rootNodes.rend( ); ++root )
+      pending.push_back(( *root )->_index );
 
-    cnode_ptr rootNode;
-    auto rootSecIt = _sectionToNodes.find( rootSection );
-    if( rootSecIt == _sectionToNodes.end( ))
+    while( !pending.empty( ))
     {
-      rootNode = new ConnectivityNode( rootSection );
-      rootNode->parent( nullptr );
+      const auto current = pending.back( );
+      pending.pop_back( );
 
-      _rootNodes.push_back( rootNode );
-      _sectionToNodes.insert( std::make_pair( rootSection, rootNode ));
-      _sectionIDToNodes.insert( std::make_pair( rootSection->id( ), rootNode ));
+      _tourIn[ current ] = static_cast< unsigned int >( _tour.size( ));
+      _tourOut[ current ] = _tourIn[ current ] + 1;
+      _tour.push_back( current );
 
-      _size += 1;
+      if( _parents[ current ] != invalidIndex )
+        _depths[ current ] = _depths[ _parents[ current ]] + 1;
 
-    }
-    else
-      rootNode = rootSecIt->second;
+      if( _childrenCount[ current ] == 0 )
+        _leafNodes.push_back( &_nodes[ current ]);
+
+      children.clear( );
+      for( auto child = _firstChildren[ current ]; child != invalidIndex;
+           child = _nextSiblings[ child ])
+        children.push_back( child );
 
+      pending.insert( pending.end( ), children.rbegin( ), children.rend( ));
+    }
 
-    cnode_ptr last = rootNode;
-    cnode_ptr node = nullptr;
-//    unsigned int i = 0;
-//    for( int i = sections.size( ) - 2; i >= 0; --i )
-    for( auto sec = sections.rbegin( ) + 1; sec != sections.rend( ); ++sec )
+    // Children are visited before their parents in reverse preorder. The
+    // last inserted child wins on equal depths.
+    _maxDepth = 0;
+    for( auto it = _tour.rbegin( ); it != _tour.rend( ); ++it )
     {
-//      auto sec = sections[ i ];
-//
-//      if( i == 0 )
-//        continue;
-      auto it = _sectionToNodes.find( *sec );
-      if( it == _sectionToNodes.end( ))
-      {
-        node = new ConnectivityNode( *sec );
-        node->parent( last );
+      const auto current = *it;
 
-        it = _sectionToNodes.insert( std::make_pair( *sec, node )).first;
-        _sectionIDToNodes.insert( std::make_pair( ( *sec )->id( ), node ));
+      const auto deepest = _deepestChildren[ current ];
+      if( deepest != invalidIndex )
+        _deepestLeaves[ current ] = _deepestLeaves[ deepest ] == invalidIndex ?
+                                    deepest : _deepestLeaves[ deepest ];
 
-        _size += 1;
+      const auto parent = _parents[ current ];
+      if( parent == invalidIndex )
+      {
+        _maxDepth = std::max( _maxDepth, _subtreeDepths[ current ] + 1 );
+        continue;
       }
-      else
-        node = it->second;
-//      ++i;
-      last->addChild( node );
 
-      last = node;
+      _tourOut[ parent ] = std::max( _tourOut[ parent ], _tourOut[ current ]);
 
+      if( _subtreeDepths[ current ] + 1 > _subtreeDepths[ parent ])
+      {
+        _subtreeDepths[ parent ] = _subtreeDepths[ current ] + 1;
+        _deepestChildren[ parent ] = current;
+      }
     }
+  }
 
-    if( rootNode->childrenMaxDepth( ) + 1 > _maxDepth )
-      _maxDepth = rootNode->childrenMaxDepth( ) + 1;
-
-    return sections.size( );
+  cnode_ptr ConnectivityTree::_node( unsigned int index ) const
+  {
+    if( index == invalidIndex )
+      return nullptr;
 
+    return const_cast< cnode_ptr >( &_nodes[ index ]);
   }
 
   size_t ConnectivityTree::size( void ) const
   {
-    return _size;
+    return _nodes.size( );
   }
 
   unsigned int ConnectivityTree::maxDepth( void ) const
@@ -330,52 +288,14 @@ namespace syncopa
     return _maxDepth;
   }
 
-
-  tCNodeVec ConnectivityTree::rootNodes( void ) const
+  const tCNodeVec& ConnectivityTree::rootNodes( void ) const
   {
-    tCNodeVec result;
-    result.reserve( _rootNodes.size( ));
-
-    for( auto node : _rootNodes )
-    {
-      result.push_back( node );
-    }
-
-    return result;
+    return _rootNodes;
   }
 
-  tCNodeVec ConnectivityTree::leafNodes( void ) const
+  const tCNodeVec& ConnectivityTree::leafNodes( void ) const
   {
-    tCNodeVec result;
-
-    std::queue< cnode_ptr> pending;
-
-    for( auto node : _rootNodes )
-    {
-      pending.push( node );
-    }
-
-    cnode_ptr currentNode;
-    while( !pending.empty( ))
-    {
-      currentNode = pending.front( );
-
-      if( currentNode->numberOfChildren( ) > 0 )
-      {
-        for( auto child : currentNode->children( ))
-        {
-          pending.push( child );
-        }
-      }
-      else
-      {
-        result.push_back( currentNode );
-      }
-
-      pending.pop( );
-    }
-
-    return result;
+    return _leafNodes;
   }
 
   cnode_ptr ConnectivityTree::node( nsol::NeuronMorphologySectionPtr section_) const
@@ -384,7 +304,7 @@ namespace syncopa
     if( it == _sectionToNodes.end( ))
       return nullptr;
     else
-      return it->second;
+      return _node( it->second );
   }
 
   cnode_ptr ConnectivityTree::node( unsigned int sectionID ) const
@@ -397,6 +317,12 @@ namespace syncopa
   }
 
 
+  const std::unordered_map< unsigned int, cnode_ptr >&
+  ConnectivityTree::nodesByID( void ) const
+  {
+    return _sectionIDToNodes;
+  }
+
   bool ConnectivityTree::hasNode( nsol::NeuronMorphologySectionPtr section_ ) const
   {
     return _sectionToNodes.find( section_ ) != _sectionToNodes.end( );
@@ -404,57 +330,52 @@ namespace syncopa
 
   void ConnectivityTree::clear( )
   {
-    _size = 0;
     _maxDepth = 0;
+
+    _nodes.clear( );
+
+    _parents.clear( );
+    _firstChildren.clear( );
+    _lastChildren.clear( );
+    _nextSiblings.clear( );
+    _childrenCount.clear( );
+
+    _depths.clear( );
+    _subtreeDepths.clear( );
+    _deepestChildren.clear( );
+    _deepestLeaves.clear( );
+
+    _tourIn.clear( );
+    _tourOut.clear( );
+    _tour.clear( );
+
     _rootNodes.clear( );
+    _leafNodes.clear( );
     _sectionToNodes.clear( );
     _sectionIDToNodes.clear( );
   }
 
   void ConnectivityTree::print( void ) const
   {
-    cnode_ptr currentNode = nullptr;
-
-    std::queue< cnode_ptr > pending;
-
-    for( auto rootNode : _rootNodes )
-    {
-      pending.push( rootNode );
-    }
-
-    while( !pending.empty( ))
+    for( auto index : _tour )
     {
-      currentNode = pending.front( );
+      const auto& currentNode = _nodes[ index ];
 
-      if( !currentNode->parent( ))
+      if( !currentNode.parent( ))
         std::cout << "Root ";
       else
         std::cout << "Node ";
 
-      std::cout << currentNode->section( )->id( )
-                << " children (" << currentNode->numberOfChildren( ) << ") ";
+      std::cout << currentNode.section( )->id( )
+                << " children (" << currentNode.numberOfChildren( ) << ") ";
 
-      for( auto child : currentNode->children( ))
-      {
+      for( auto child : currentNode.children( ))
         std::cout << child->section( )->id( ) << " ";
 
-        pending.push( child );
-      }
-
-//      if( currentNode->numberOfChildren( ) > 2 )
-      {
-//        std::cout << " -> (" << currentNode->section( )->forwardNeighbors( ).size( ) << ") ";
-
-        for( auto child : currentNode->deepestPath( ))
-//        for( auto child : currentNode->section( )->forwardNeighbors( ))
-        {
-          std::cout  << " " << child->section( )->id( );
-        }
-      }
+      for( auto child : currentNode.deepestPath( ))
+        std::cout  << " " << child->section( )->id( );
 
       std::cout << std::endl;
-
-      pending.pop( );
     }
   }
 
@@ -11,89 +11,95 @@
 
 #include "types.h"
 
-#include <nsol/nsol.h>
+#include <deque>
 
-#include "PolylineInterpolation.hpp"
+#include <nsol/nsol.h>
 
 namespace syncopa
 {
 
   class ConnectivityNode;
+  class ConnectivityTree;
 
   typedef ConnectivityNode* cnode_ptr;
   typedef std::vector< cnode_ptr > tCNodeVec;
 
+  /*! Handle to a node of a ConnectivityTree. The topology is stored by the
+   * tree in index arrays, nodes only keep their section and their index.
+   * Queries other than section( ) and parent( ) are valid once the tree is
+   * finalized. */
   class ConnectivityNode
   {
+    friend class ConnectivityTree;
+
   public:
 
-    ConnectivityNode( nsolMSection_ptr section );
+    ConnectivityNode( const ConnectivityTree* tree , unsigned int index ,
+                      nsolMSection_ptr section );
 
-    void parent( cnode_ptr parent_ );
-    cnode_ptr parent( void ) const;
+    unsigned int index( void ) const;
 
-    void sectionLength( float length_ );
-    float sectionLength( void ) const;
-
-    void addChild( cnode_ptr );
-    cnode_ptr child( nsol::NeuronMorphologySectionPtr section_ );
+    cnode_ptr parent( void ) const;
 
     cnode_ptr firstChild( void ) const;
     cnode_ptr lastChild( void ) const;
 
     unsigned int numberOfChildren( void ) const;
     tCNodeVec children( void ) const;
+
+    //! Every descendant of the node, in depth first order.
     tCNodeVec allChildren( void ) const;
     tCNodeVec allFirstChildren( void ) const;
 
+    //! Descendants from the node child to its deepest leaf.
     tCNodeVec deepestPath( bool fromRoot = true ) const;
     cnode_ptr deepestChild( void ) const;
     cnode_ptr deepestBranchNode( void ) const;
 
-    void section( nsol::NeuronMorphologySectionPtr section_ );
     nsol::NeuronMorphologySectionPtr section( void ) const;
 
-    void initializeInterpolator( const mat4& transform );
+    //! Sections between the node and its root.
+    unsigned int depth( void ) const;
 
+    //! Sections between the node and its deepest leaf.
     unsigned int childrenMaxDepth( void ) const;
 
-  protected:
-
-    ConnectivityNode( void );
+    bool isAncestorOf( const ConnectivityNode* node ) const;
 
-    void _calculateDeepestPath( void );
+  protected:
 
-    void _propagateDepth( const cnode_ptr sourceChild );
+    const ConnectivityTree* _tree;
+    unsigned int _index;
 
     nsol::NeuronMorphologySectionPtr _section;
-
-    float _sectionLength;
-
-    cnode_ptr _parent;
-
-    std::unordered_map< nsol::NeuronMorphologySectionPtr, cnode_ptr > _children;
-
-    unsigned int _maxDepth;
-    cnode_ptr _deepestChildrenNode;
-    cnode_ptr _deepestChild;
-
-    utils::PolylineInterpolation _interpolator;
   };
 
 
+  /*! Tree of the sections between the synapses of a neuron and its soma.
+   * Nodes live in an arena owned by the tree and are released together
+   * when the tree is cleared or destroyed. After adding the branches,
+   * finalize( ) computes depths, the Euler tour and the leaf list. */
   class ConnectivityTree
   {
+    friend class ConnectivityNode;
 
   public:
 
+    static const unsigned int invalidIndex;
+
     ConnectivityTree( );
 
+    ConnectivityTree( const ConnectivityTree& ) = delete;
+    ConnectivityTree& operator=( const ConnectivityTree& ) = delete;
+
     void clear( );
 
     unsigned int addBranch( const std::vector< nsolMSection_ptr >& sections );
 
-    tCNodeVec rootNodes( void ) const;
-    tCNodeVec leafNodes( void ) const;
+    void finalize( void );
+
+    const tCNodeVec& rootNodes( void ) const;
+    const tCNodeVec& leafNodes( void ) const;
 
     size_t size( void ) const;
     unsigned int maxDepth( void ) const;
@@ -103,20 +109,42 @@ namespace syncopa
 
     bool hasNode( nsol::NeuronMorphologySectionPtr section_ ) const;
 
+    const std::unordered_map< unsigned int, cnode_ptr >& nodesByID( void ) const;
+
     void print( void ) const;
 
   protected:
 
-    unsigned int _size;
+    unsigned int _addNode( nsolMSection_ptr section, unsigned int parent );
+
+    cnode_ptr _node( unsigned int index ) const;
+
     unsigned int _maxDepth;
 
+    //! Node arena, deque keeps handles valid while the tree grows.
+    std::deque< ConnectivityNode > _nodes;
+
+    std::vector< unsigned int > _parents;
+    std::vector< unsigned int > _firstChildren;
+    std::vector< unsigned int > _lastChildren;
+    std::vector< unsigned int > _nextSiblings;
+    std::vector< unsigned int > _childrenCount;
+
+    std::vector< unsigned int > _depths;
+    std::vector< unsigned int > _subtreeDepths;
+    std::vector< unsigned int > _deepestChildren;
+    std::vector< unsigned int > _deepestLeaves;
+
+    //! Euler tour, descendants of a node are in [ _tourIn, _tourOut ).
+    std::vector< unsigned int > _tourIn;
+    std::vector< unsigned int > _tourOut;
+    std::vector< unsigned int > _tour;
+
     tCNodeVec _rootNodes;
     tCNodeVec _leafNodes;
 
     std::unordered_map< unsigned int, cnode_ptr > _sectionIDToNodes;
-    std::unordered_map< nsol::NeuronMorphologySectionPtr, cnode_ptr > _sectionToNodes;
-
-
+    std::unordered_map< nsol::NeuronMorphologySectionPtr, unsigned int > _sectionToNodes;
   };
 
 
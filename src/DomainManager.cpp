@@ -27,6 +27,10 @@ namespace syncopa
   {
     _dataset = dataset_;
 
+    _synapseIndex.clear( );
+    if ( _dataset )
+      _synapseIndex.build( _dataset->circuit( ).synapses( ));
+
     _loadSynapseInfo( );
   }
 
@@ -154,65 +158,62 @@ namespace syncopa
   {
     tsynapseVec result;
 
+    // Sorted, so that synapses are returned in neuron order.
     std::set< unsigned int > gidset( gids.begin( ) , gids.end( ));
 
-    auto& circuit = _dataset->circuit( );
-    auto synapseSet = circuit.synapses( gidset ,
-                                        nsol::Circuit::PRESYNAPTICCONNECTIONS );
+    size_t size = 0;
+    for ( const auto gid: gidset )
+      size += _synapseIndex.presynaptic( gid ).size( );
 
-    result.reserve( synapseSet.size( ));
+    result.reserve( size );
 
-    for ( auto& syn: synapseSet )
+    // Index rows are walked in place, without copying them.
+    for ( const auto gid: gidset )
     {
-      auto msyn = dynamic_cast< nsolMSynapse_ptr >( syn );
-      if ( !msyn )
+      for ( const auto msyn: _synapseIndex.presynaptic( gid ))
       {
-        if ( log )
-          std::cout << "EMPTY SYNAPSE " << std::endl;
-        continue;
-      }
+        if ( !filter( msyn )) continue;
 
-      if ( !filter( msyn )) continue;
+        const auto sectionPre = msyn->preSynapticSection( );
+        const auto sectionPost = msyn->postSynapticSection( );
 
-      const auto sectionPre = msyn->preSynapticSection( );
-      const auto sectionPost = msyn->postSynapticSection( );
+        // axo-somatic
+        if ( !sectionPre || ( !sectionPost &&
+                              msyn->synapseType( ) !=
+                              nsol::MorphologySynapse::AXOSOMATIC ))
+          continue;
 
-      // axo-somatic
-      if ( !sectionPre || ( !sectionPost &&
-                            msyn->synapseType( ) !=
-                            nsol::MorphologySynapse::AXOSOMATIC ))
-        continue;
+        const auto synInfo = _synapseFixInfo.find( msyn );
+        if ( synInfo == _synapseFixInfo.end( ))
+          continue;
 
-      const auto synInfo = _synapseFixInfo.find( msyn );
-      if ( synInfo == _synapseFixInfo.end( ))
-        continue;
+        const auto infoPre = std::get< TBSI_PRESYNAPTIC >( synInfo->second );
+        const auto infoPost = std::get< TBSI_POSTSYNAPTIC >( synInfo->second );
 
-      const auto infoPre = std::get< TBSI_PRESYNAPTIC >( synInfo->second );
-      const auto infoPost = std::get< TBSI_POSTSYNAPTIC >( synInfo->second );
+        if ( std::get< TBS_SEGMENT_INDEX >( infoPre ) >=
+             sectionPre->nodes( ).size( ) - 1 )
+        {
+          if ( log )
+            std::cout << "Discarding synapse with pre segment "
+                      << std::get< TBS_SEGMENT_INDEX >( infoPre )
+                      << " segments " << ( sectionPre->nodes( ).size( ) - 1 )
+                      << std::endl;
+          continue;
+        }
 
-      if ( std::get< TBS_SEGMENT_INDEX >( infoPre ) >=
-           sectionPre->nodes( ).size( ) - 1 )
-      {
-        if ( log )
-          std::cout << "Discarding synapse with pre segment "
-                    << std::get< TBS_SEGMENT_INDEX >( infoPre )
-                    << " segments " << ( sectionPre->nodes( ).size( ) - 1 )
-                    << std::endl;
-        continue;
-      }
+        if ( sectionPost && std::get< TBS_SEGMENT_INDEX >( infoPost ) >=
+                            sectionPost->nodes( ).size( ) - 1 )
+        {
+          if ( log )
+            std::cout << "Discarding synapse with post segment "
+                      << std::get< TBS_SEGMENT_INDEX >( infoPost )
+                      << " segments " << ( sectionPost->nodes( ).size( ) - 1 )
+                      << std::endl;
+          continue;
+        }
 
-      if ( sectionPost && std::get< TBS_SEGMENT_INDEX >( infoPost ) >=
-                          sectionPost->nodes( ).size( ) - 1 )
-      {
-        if ( log )
-          std::cout << "Discarding synapse with post segment "
-                    << std::get< TBS_SEGMENT_INDEX >( infoPost )
-                    << " segments " << ( sectionPost->nodes( ).size( ) - 1 )
-                    << std::endl;
-        continue;
+        result.push_back( msyn );
       }
-
-      result.push_back( msyn );
     }
 
     result.shrink_to_fit( );
@@ -228,28 +229,17 @@ namespace syncopa
 
     std::vector< nsolMSynapse_ptr > result;
 
-    std::set< unsigned int > gidsPre = { presynapticGID };
-
-    const auto& circuit = _dataset->circuit( );
-    const auto synapseSet = circuit.synapses( gidsPre ,
-                                              nsol::Circuit::PRESYNAPTICCONNECTIONS );
+    const auto synapseSet = _synapseIndex.presynaptic( presynapticGID );
 
     result.reserve( synapseSet.size( ));
 
-    for ( const auto& syn: synapseSet )
+    for ( const auto msyn: synapseSet )
     {
       if ( !postsynapticGIDs.empty( ) &&
-           postsynapticGIDs.find( syn->postSynapticNeuron( )) ==
+           postsynapticGIDs.find( msyn->postSynapticNeuron( )) ==
            postsynapticGIDs.end( ))
         continue;
 
-      auto msyn = dynamic_cast< nsolMSynapse_ptr >( syn );
-      if ( !msyn )
-      {
-        std::cout << "EMPTY SYNAPSE " << std::endl;
-        continue;
-      }
-
       const auto sectionPre = msyn->preSynapticSection( );
       const auto sectionPost = msyn->postSynapticSection( );
 
@@ -10,6 +10,7 @@
 #define SRC_DOMAINMANAGER_H_
 
 #include "types.h"
+#include "SynapseIndex.h"
 
 #include <QPolygonF>
 
@@ -48,6 +49,9 @@ namespace syncopa
     inline const TSynapseInfo& synapsesInfo( void ) const
     { return _synapseFixInfo; }
 
+    inline const SynapseIndex& synapseIndex( void ) const
+    { return _synapseIndex; }
+
     void setSynapseFilteringState( bool state );
 
     void
@@ -95,6 +99,8 @@ namespace syncopa
 
     TSynapseInfo _synapseFixInfo;
 
+    SynapseIndex _synapseIndex;
+
     unsigned int _presynapticGID;
 
     TBrainSynapseAttribs _currentAttrib;
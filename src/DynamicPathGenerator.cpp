@@ -4,148 +4,754 @@
 
 #include "DynamicPathGenerator.h"
 
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
 #include <QDebug>
 
 namespace syncopa
 {
 
-  void DynamicPathGenerator::walkSection(
-    PathGeneratorGeneralData& general , PathGeneratorData& data )
+  void DynamicPathGenerator::computeArrivals(
+    const PathFinder& pathFinder , unsigned int gid ,
+    const ConnectivityTree& tree , float velocity ,
+    std::vector< PathGeneratorData >& result ,
+    std::vector< SectionArrival >& sections )
   {
-    float distance = 0;
-    float displacement = general.step * general.velocity;
+    const auto task = pathFinder.neuronPaths( gid );
+    const SectionTable* table = task ? task->sections : nullptr;
 
-    // Iterate positions and events.
-    while ( distance < data.section.totalDistance( ))
+    // Time at which the wavefront leaves each section, by node index.
+    std::vector< float > departures( tree.size( ) , 0.0f );
+
+    for ( const auto root: tree.rootNodes( ))
     {
-      auto position = data.section.pointAtDistance( distance );
-      general.maxTime = std::max( general.maxTime , data.time );
+      auto nodes = root->allChildren( );
+      nodes.insert( nodes.begin( ) , root );
+
+      // Preorder, so parents are always reached before their children.
+      for ( const auto node: nodes )
+      {
+        const auto parent = node->parent( );
+        const float arrival = parent ? departures[ parent->index( ) ] : 0.0f;
+
+        const auto index = table ? table->find( node->section( ))
+                                 : SectionTable::invalidIndex;
+
+        utils::PolylineInterpolation path;
+        if ( table && table->isCut( index ))
+        {
+          const auto cut = table->cutNodes( index );
+          path = utils::PolylineInterpolation( tPosVec( cut.begin( ) , cut.end( )));
+        }
+        else
+        {
+          path = pathFinder.geometry( ).section( gid , node->section( ));
+        }
 
-      general.particles.push_back(
-        particle( position , data.postsynaptic , data.time ));
+        const float length = path.totalDistance( );
+        departures[ node->index( ) ] = arrival + length / velocity;
 
-      manageEvents( general , data , distance );
+        if ( table )
+        {
+          for ( const auto& sectionSynapse: table->synapses( index ))
+          {
+            // Postsynaptic synapses of this neuron do not start new paths.
+            if ( sectionSynapse.type != PRESYNAPTIC )
+              continue;
 
-      data.time += general.step;
-      distance += displacement;
+            const auto synapse = sectionSynapse.synapse;
+            if ( synapse->synapseType( ) == nsol::MorphologySynapse::AXOSOMATIC )
+              continue;
+
+            const float distance = std::min( sectionSynapse.distance , length );
+            const float hit = arrival + distance / velocity;
+
+            // Sections shared with other synapses become template instances.
+            tPosVec head;
+            tCNodeVec postNodes;
+            if ( !pathFinder.postsynapticSections( synapse , head , postNodes ))
+            {
+              std::cerr << "Empty post path on synapse " << synapse->gid( )
+                        << "." << std::endl;
+              continue;
+            }
+
+            utils::PolylineInterpolation headPath( head );
+            const unsigned int postGid = synapse->postSynapticNeuron( );
+
+            float time = hit + headPath.totalDistance( ) / velocity;
+            for ( const auto postNode: postNodes )
+            {
+              sections.push_back( SectionArrival{ postGid , postNode , time } );
+              time += pathFinder.geometry( ).sectionLength(
+                postGid , postNode->section( )) / velocity;
+            }
+
+            result.emplace_back( std::move( headPath ) , true , hit );
+          }
+        }
+
+        result.emplace_back( std::move( path ) , false , arrival );
+      }
     }
   }
 
-  void DynamicPathGenerator::manageEvents(
-    PathGeneratorGeneralData& general ,
-    const PathGeneratorData& data , float distance )
+  void DynamicPathGenerator::sampleRange(
+    const utils::PolylineInterpolation& path , float time ,
+    float step , float velocity ,
+    unsigned int& first , unsigned int& last )
   {
-    const auto events = data.section.eventsAt(
-      distance , general.step * general.velocity );
-    for ( const auto& event: events )
+    first = static_cast< unsigned int >( std::ceil( time / step ));
+    last = first;
+    if ( path.empty( ))
+      return;
+
+    // Particles are placed while the wavefront is inside the path.
+    const float end = time + path.totalDistance( ) / velocity;
+    last = std::max( first ,
+                     static_cast< unsigned int >( std::ceil( end / step )));
+  }
+
+  void DynamicPathGenerator::emitParticles(
+    const PathGeneratorData& data , float step , float velocity ,
+    unsigned int first , unsigned int last , DynamicPathParticle* result )
+  {
+    const float length = data.path.totalDistance( );
+    utils::PolylineCursor cursor( data.path );
+
+    // Particles keep the global time step, so consecutive sections continue
+    // the spacing of their parents without duplicating the shared node.
+    for ( unsigned int i = first; i < last; ++i )
     {
-      const auto id = std::get< 1 >( event );
+      const float time = i * step;
+      const float distance =
+        std::min(( time - data.time ) * velocity , length );
+
+      *result++ = particle( cursor.pointAtDistance( distance ) ,
+                            data.postsynaptic , time );
+    }
+  }
+
+  DynamicPathParticle
+  DynamicPathGenerator::particle(
+    const vec3& position , bool postsynaptic , float time )
+  {
+    DynamicPathParticle particle = DynamicPathParticle( );
+    particle.position = eigenToGLM( position );
+    particle.isPostsynaptic = postsynaptic ? 1.0f : 0.0f;
+    particle.timestamp = time;
+    return particle;
+  }
+
+  void DynamicPathGenerator::segmentSteps(
+    const utils::PolylineInterpolation& path , float time ,
+    float step , float velocity ,
+    unsigned int& first , unsigned int& last )
+  {
+    first = static_cast< unsigned int >( std::floor( time / step ));
+    last = first;
+    if ( path.size( ) < 2 )
+      return;
+
+    const float lastStart = time + path.distance( path.size( ) - 2 ) / velocity;
+    last = static_cast< unsigned int >( std::floor( lastStart / step )) + 1;
+  }
+
+  unsigned int DynamicPathGenerator::segmentFrom(
+    const utils::PolylineInterpolation& path , float start ,
+    float velocity , float time )
+  {
+    const float distance = ( time - start ) * velocity;
+
+    unsigned int low = 0;
+    unsigned int high = static_cast< unsigned int >( path.size( )) - 1;
+    while ( low < high )
+    {
+      const unsigned int middle = ( low + high ) / 2;
+      if ( path.distance( middle ) < distance )
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    return low;
+  }
+
+  void DynamicPathGenerator::emitSegments(
+    const utils::PolylineInterpolation& path , float time ,
+    bool postsynaptic , float velocity ,
+    unsigned int first , unsigned int last , DynamicPathSegment* result )
+  {
+    for ( unsigned int i = first; i < last; ++i )
+    {
+      DynamicPathSegment segment = DynamicPathSegment( );
+      segment.start = eigenToGLM( path[ i ] );
+      segment.end = eigenToGLM( path[ i + 1 ] );
+      segment.times = glm::vec2( time + path.distance( i ) / velocity ,
+                                 time + path.distance( i + 1 ) / velocity );
+      segment.isPostsynaptic = postsynaptic ? 1.0f : 0.0f;
+
+      *result++ = segment;
+    }
+  }
+
+  bool DynamicPathGenerator::evaluate( const DynamicPathSegment& segment ,
+                                       float timestamp , float pulseDuration ,
+                                       DynamicPulse& pulse )
+  {
+    const float tailTime = std::max( segment.times.x , timestamp - pulseDuration );
+    const float headTime = std::min( segment.times.y , timestamp );
+    if ( headTime <= tailTime )
+      return false;
+
+    const float duration = std::max( segment.times.y - segment.times.x , 1e-6f );
+    pulse.tail = glm::mix( segment.start , segment.end ,
+                           ( tailTime - segment.times.x ) / duration );
+    pulse.head = glm::mix( segment.start , segment.end ,
+                           ( headTime - segment.times.x ) / duration );
+    pulse.tailAlpha = 1.0f - ( timestamp - tailTime ) / pulseDuration;
+    pulse.headAlpha = 1.0f - ( timestamp - headTime ) / pulseDuration;
+    return true;
+  }
+
+#ifdef DEBUG
+  bool DynamicPathGenerator::checkEvaluate( const PathGeneratorData& data ,
+                                            float step , float velocity )
+  {
+    if ( data.path.size( ) < 2 )
+      return true;
+
+    unsigned int first , last;
+    sampleRange( data.path , data.time , step , velocity , first , last );
+    std::vector< DynamicPathParticle > particles( last - first );
+    emitParticles( data , step , velocity , first , last , particles.data( ));
+
+    const auto segmentCount = static_cast< unsigned int >( data.path.size( )) - 1;
+    std::vector< DynamicPathSegment > segments( segmentCount );
+    emitSegments( data.path , data.time , data.postsynaptic , velocity ,
+                  0 , segmentCount , segments.data( ));
+
+    const float pulseDuration = step * 4.0f;
+    const float tolerance = 1e-3f * std::max( 1.0f , data.path.totalDistance( ));
+    for ( const auto& particle: particles )
+    {
+      // A particle at the start of the path is not lit by any segment yet.
+      const auto segment = std::find_if( segments.begin( ) , segments.end( ) ,
+        [ &particle ]( const DynamicPathSegment& candidate )
+        {
+          return candidate.times.x < particle.timestamp &&
+                 particle.timestamp <= candidate.times.y;
+        } );
+      if ( segment == segments.end( ))
+        continue;
+
+      DynamicPulse pulse;
+      if ( !evaluate( *segment , particle.timestamp , pulseDuration , pulse ) ||
+           glm::distance( pulse.head , particle.position ) > tolerance ||
+           std::abs( pulse.headAlpha - 1.0f ) > 1e-5f )
+        return false;
+    }
+
+    return true;
+  }
+#endif
+
+  DynamicPathGenerator::DynamicPathGenerator( void )
+    : _analytic( false )
+    , _step( 0.0f )
+    , _velocity( 0.0f )
+    , _maxTime( 0.0f )
+    , _windowDuration( 0.0f )
+    , _cancel( false )
+    , _readyTime( 0.0f )
+    , _finished( true )
+  { }
+
+  DynamicPathGenerator::~DynamicPathGenerator( void )
+  {
+    stop( );
+  }
+
+  void DynamicPathGenerator::start( const PathFinder& pathFinder ,
+                                    float step , float velocity ,
+                                    size_t budget )
+  {
+    stop( );
+
+    _step = step;
+    _velocity = velocity;
+
+    std::vector< std::pair< unsigned int , const ConnectivityTree* >> trees;
+    for ( const auto& item: pathFinder.presynapticTrees( ))
+      trees.emplace_back( item.first , &item.second );
+
+    const int treeCount = static_cast< int >( trees.size( ));
+    std::vector< std::vector< PathGeneratorData >> treePaths( trees.size( ));
+    std::vector< std::vector< SectionArrival >> treeSections( trees.size( ));
+
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < treeCount; ++i )
+    {
+      computeArrivals( pathFinder , trees[ i ].first , *trees[ i ].second ,
+                       velocity , treePaths[ i ] , treeSections[ i ] );
+    }
+
+    _paths.clear( );
+    for ( auto& item: treePaths )
+    {
+      std::move( item.begin( ) , item.end( ) , std::back_inserter( _paths ));
+      item.clear( );
+    }
+
+    std::vector< SectionArrival > sections;
+    for ( auto& item: treeSections )
+    {
+      sections.insert( sections.end( ) , item.begin( ) , item.end( ));
+      item.clear( );
+    }
+    _createInstances( pathFinder , sections );
+
+    if ( !_analytic )
+      _fitStep( budget );
+
+#ifdef DEBUG
+    // The budget only applies to particles.
+    std::cout << "Dynamic paths: step " << _step << " (requested " << step
+              << "), " << _count( );
+    if ( _analytic )
+      std::cout << " segments, ";
+    else
+      std::cout << " particles for a budget of " << budget << ", ";
+    std::cout << _templates.size( ) << " postsynaptic templates with "
+              << _instances.size( ) << " instances." << std::endl;
+
+    // Segments must light the positions the particles would have.
+    for ( size_t i = 0; i < std::min( _paths.size( ) , size_t( 16 )); ++i )
+      assert( checkEvaluate( _paths[ i ] , _step , velocity ));
+#endif
+
+    // Templates are sampled once, from time zero.
+    _templateOffsets.assign( _templates.size( ) + 1 , 0 );
+    _templateParticles.clear( );
+    if ( !_analytic )
+    {
+      for ( size_t i = 0; i < _templates.size( ); ++i )
+      {
+        unsigned int first , last;
+        sampleRange( _templates[ i ] , 0.0f , _step , velocity , first , last );
+        _templateOffsets[ i + 1 ] = _templateOffsets[ i ] + last - first;
+      }
+
+      _templateParticles.resize( _templateOffsets.back( ));
+
+      const int templateCount = static_cast< int >( _templates.size( ));
+
+#pragma omp parallel for schedule(dynamic, 64)
+      for ( int i = 0; i < templateCount; ++i )
+      {
+        emitParticles( PathGeneratorData( _templates[ i ] , true , 0.0f ) ,
+                       _step , velocity , 0 ,
+                       static_cast< unsigned int >(
+                         _templateOffsets[ i + 1 ] - _templateOffsets[ i ] ) ,
+                       _templateParticles.data( ) + _templateOffsets[ i ] );
+      }
+    }
+
+    const size_t sourceCount = _paths.size( ) + _instances.size( );
+    _firstSteps.resize( sourceCount );
+    _lastSteps.resize( sourceCount );
+    _maxTime = 0.0f;
+    for ( unsigned int i = 0; i < sourceCount; ++i )
+    {
+      float time;
+      const auto& path = _source( i , time );
+
+      if ( _analytic )
+      {
+        segmentSteps( path , time , _step , velocity ,
+                      _firstSteps[ i ] , _lastSteps[ i ] );
+
+        if ( _lastSteps[ i ] > _firstSteps[ i ] )
+        {
+          _maxTime = std::max(
+            _maxTime , time + path.totalDistance( ) / velocity );
+        }
+        continue;
+      }
 
-      // New section reached
-      if ( std::get< 2 >( event ) == utils::TEvent_section )
+      if ( i < _paths.size( ))
       {
-        manageNewSection( general , data , id );
+        sampleRange( path , time , _step , velocity ,
+                     _firstSteps[ i ] , _lastSteps[ i ] );
       }
-        // Synapse reached!
       else
       {
-        manageSynapse( general , data , id );
+        // Instances start at the step following their arrival, so they
+        // reuse the particles of their template with shifted timestamps.
+        const auto pathTemplate = _instances[ i - _paths.size( ) ].pathTemplate;
+        _firstSteps[ i ] =
+          static_cast< unsigned int >( std::ceil( time / _step ));
+        _lastSteps[ i ] = _firstSteps[ i ] + static_cast< unsigned int >(
+          _templateOffsets[ pathTemplate + 1 ] -
+          _templateOffsets[ pathTemplate ] );
       }
 
+      if ( _lastSteps[ i ] > _firstSteps[ i ] )
+        _maxTime = std::max( _maxTime , ( _lastSteps[ i ] - 1 ) * _step );
     }
+    _nextSegments.assign( _analytic ? sourceCount : 0 , 0 );
+
+    _chunks.clear( );
+    _segmentChunks.clear( );
+    _readyTime = 0.0f;
+    _finished = false;
+    _cancel = false;
+
+    _thread = std::thread( &DynamicPathGenerator::_emitWindows , this );
   }
 
-  void DynamicPathGenerator::manageNewSection(
-    PathGeneratorGeneralData& general ,
-    const PathGeneratorData& data , uint64_t id )
+  const utils::PolylineInterpolation&
+  DynamicPathGenerator::_source( unsigned int source , float& time ) const
   {
-    const auto node = general.pathFinder.node( id ).second;
-    if ( node == nullptr )
+    if ( source < _paths.size( ))
     {
-      std::cerr << "Couldn't find section node " << id << "." << std::endl;
-      return;
+      time = _paths[ source ].time;
+      return _paths[ source ].path;
     }
 
-    for ( const auto child: node->children( ))
+    const auto& instance = _instances[ source - _paths.size( ) ];
+    time = instance.time;
+    return _templates[ instance.pathTemplate ];
+  }
+
+  void DynamicPathGenerator::_createInstances(
+    const PathFinder& pathFinder ,
+    const std::vector< SectionArrival >& sections )
+  {
+    _templates.clear( );
+    _templateUses.clear( );
+    _instances.clear( );
+    _instances.reserve( sections.size( ));
+
+    std::unordered_map< cnode_ptr , unsigned int > templates;
+    for ( const auto& arrival: sections )
     {
-      PathGeneratorData newData = data;
-      newData.section = general.pathFinder.computeDeepestPathFrom( id, child );
-      walkSection( general , newData );
+      auto it = templates.find( arrival.node );
+      if ( it == templates.end( ))
+      {
+        // Postsynaptic paths walk sections from their end to the soma.
+        const auto& positions = pathFinder.geometry( ).section(
+          arrival.gid , arrival.node->section( )).positions( );
+
+        it = templates.emplace(
+          arrival.node , static_cast< unsigned int >( _templates.size( ))).first;
+        _templates.emplace_back(
+          tPosVec( positions.rbegin( ) , positions.rend( )));
+        _templateUses.push_back( 0 );
+      }
+
+      ++_templateUses[ it->second ];
+      _instances.push_back( PathInstance{ it->second , arrival.time } );
     }
   }
 
-  void DynamicPathGenerator::manageSynapse(
-    PathGeneratorGeneralData& general ,
-    const PathGeneratorData& data , uint64_t id )
+  size_t DynamicPathGenerator::_count( void ) const
   {
-    const auto synapse = reinterpret_cast< nsolMSynapse_ptr >( id );
+    size_t count = 0;
+    for ( const auto& data: _paths )
+    {
+      if ( _analytic )
+      {
+        if ( data.path.size( ) > 1 )
+          count += data.path.size( ) - 1;
+        continue;
+      }
 
-    if ( synapse->synapseType( ) == nsol::MorphologySynapse::AXOSOMATIC )
-      return;
+      unsigned int first , last;
+      sampleRange( data.path , data.time , _step , _velocity , first , last );
+      count += last - first;
+    }
 
-    const auto path = general.pathFinder.getPostsynapticPath( synapse );
-    if ( path.empty( ))
+    // Instances count as many particles as their templates.
+    for ( size_t i = 0; i < _templates.size( ); ++i )
     {
-      std::cerr << "Empty post path on synapse " << synapse << "." << std::endl;
+      if ( _analytic )
+      {
+        if ( _templates[ i ].size( ) > 1 )
+          count += _templateUses[ i ] * ( _templates[ i ].size( ) - 1 );
+        continue;
+      }
+
+      unsigned int first , last;
+      sampleRange( _templates[ i ] , 0.0f , _step , _velocity , first , last );
+      count += _templateUses[ i ] * static_cast< size_t >( last - first );
+    }
+
+    return count;
+  }
+
+  void DynamicPathGenerator::_fitStep( size_t budget )
+  {
+    if ( budget == 0 || _count( ) <= budget )
       return;
+
+    // Paths get about a particle per step inside them, plus one.
+    double length = 0.0;
+    for ( const auto& data: _paths )
+      length += data.path.totalDistance( );
+    for ( size_t i = 0; i < _templates.size( ); ++i )
+      length += _templateUses[ i ] * _templates[ i ].totalDistance( );
+
+    const size_t sources = _paths.size( ) + _instances.size( );
+    const double steps = budget > sources ?
+      static_cast< double >( budget - sources ) : 1.0;
+    _step = std::max( _step ,
+                      static_cast< float >( length / ( _velocity * steps )));
+
+    // Rounding of every path may still leave it slightly above.
+    for ( unsigned int i = 0; i < 64 && _count( ) > budget; ++i )
+      _step *= 1.1f;
+
+    if ( _count( ) > budget )
+    {
+      std::cerr << "Dynamic paths: " << _paths.size( ) + _instances.size( )
+                << " paths do not fit a budget of " << budget
+                << " particles." << std::endl;
     }
+  }
+
+  void DynamicPathGenerator::stop( void )
+  {
+    _cancel = true;
+    if ( _thread.joinable( ))
+      _thread.join( );
 
-    PathGeneratorData newData = data;
-    newData.section = path;
-    newData.postsynaptic = true;
-    // Walk postsynaptic instantly
-    walkSection( general , newData );
+    _paths.clear( );
+    _templates.clear( );
+    _templateUses.clear( );
+    _instances.clear( );
+    _templateParticles.clear( );
+    _templateOffsets.clear( );
+    _firstSteps.clear( );
+    _lastSteps.clear( );
+    _nextSegments.clear( );
+
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    _chunks.clear( );
+    _segmentChunks.clear( );
+    _finished = true;
   }
 
-  DynamicPathParticle
-  DynamicPathGenerator::particle(
-    const vec3& position , bool postsynaptic , float time )
+  void DynamicPathGenerator::analytic( bool state )
   {
-    DynamicPathParticle particle = DynamicPathParticle( );
-    particle.position = eigenToGLM( position );
-    particle.isPostsynaptic = postsynaptic ? 1.0f : 0.0f;
-    particle.timestamp = time;
-    return particle;
+    _analytic = state;
   }
 
-  std::pair< std::vector< DynamicPathParticle > , float >
-  DynamicPathGenerator::generateParticles(
-    PathFinder& pathFinder , float step , float velocity )
+  bool DynamicPathGenerator::analytic( void ) const
   {
-    PathGeneratorGeneralData general( pathFinder , step , velocity );
+    return _analytic;
+  }
+
+  void DynamicPathGenerator::windowDuration( float duration )
+  {
+    _windowDuration = duration;
+  }
+
+  float DynamicPathGenerator::step( void ) const
+  {
+    return _step;
+  }
+
+  float DynamicPathGenerator::maxTime( void ) const
+  {
+    return _maxTime;
+  }
 
-    std::cout << "PRES:" << std::endl;
-    for (auto& pres : pathFinder.presynapticTrees()) {
-      std::cout << pres.first << std::endl;
+  bool DynamicPathGenerator::finished( void ) const
+  {
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    return _finished && _chunks.empty( ) && _segmentChunks.empty( );
+  }
+
+  float DynamicPathGenerator::takeChunks(
+    std::vector< std::vector< DynamicPathParticle >>& chunks )
+  {
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    for ( auto& chunk: _chunks )
+      chunks.push_back( std::move( chunk ));
+    _chunks.clear( );
+
+    return _finished ? std::numeric_limits< float >::max( ) : _readyTime;
+  }
+
+  float DynamicPathGenerator::takeChunks(
+    std::vector< std::vector< DynamicPathSegment >>& chunks )
+  {
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    for ( auto& chunk: _segmentChunks )
+      chunks.push_back( std::move( chunk ));
+    _segmentChunks.clear( );
+
+    return _finished ? std::numeric_limits< float >::max( ) : _readyTime;
+  }
+
+  void DynamicPathGenerator::_emitWindows( void )
+  {
+    // Steps of the first window and largest window, doubling in between.
+    const unsigned int maxWindow = _windowDuration > 0.0f ?
+      std::max( 1u , static_cast< unsigned int >(
+        std::ceil( _windowDuration / _step ))) : 4096u;
+    const unsigned int firstWindow = std::min( 64u , maxWindow );
+
+    std::vector< unsigned int > order;
+    unsigned int lastStep = 0;
+    for ( unsigned int i = 0; i < _firstSteps.size( ); ++i )
+    {
+      if ( _lastSteps[ i ] == _firstSteps[ i ] )
+        continue;
+
+      order.push_back( i );
+      lastStep = std::max( lastStep , _lastSteps[ i ] );
     }
-    std::cout << "POSTS:" << std::endl;
-    for (auto& pres : pathFinder.presynapticTrees()) {
-      std::cout << pres.first << std::endl;
+
+    std::sort( order.begin( ) , order.end( ) ,
+               [ this ]( unsigned int a , unsigned int b )
+               { return _firstSteps[ a ] < _firstSteps[ b ]; } );
+
+    // Paths reached by the current window and not finished yet.
+    std::vector< unsigned int > active;
+    size_t next = 0;
+
+    unsigned int window = firstWindow;
+    for ( unsigned int begin = 0; begin < lastStep && !_cancel; )
+    {
+      const unsigned int end = begin + std::min( window , lastStep - begin );
+      window = std::min( window * 2 , maxWindow );
+
+      while ( next < order.size( ) && _firstSteps[ order[ next ]] < end )
+        active.push_back( order[ next++ ] );
+
+      if ( _analytic )
+        _emitSegmentWindow( active , end );
+      else
+        _emitParticleWindow( active , begin , end );
+
+      active.erase( std::remove_if( active.begin( ) , active.end( ) ,
+                                    [ this , end ]( unsigned int path )
+                                    { return _lastSteps[ path ] <= end; } ) ,
+                    active.end( ));
+
+      begin = end;
+
+      std::lock_guard< std::mutex > lock( _chunksMutex );
+      _readyTime = end * _step;
     }
-    std::cout << "---" << std::endl;
 
-    for ( const auto& item: pathFinder.presynapticTrees( ))
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    _finished = true;
+  }
+
+  void DynamicPathGenerator::_emitParticleWindow(
+    const std::vector< unsigned int >& active ,
+    unsigned int begin , unsigned int end )
+  {
+    std::vector< size_t > offsets( active.size( ) + 1 , 0 );
+    for ( size_t i = 0; i < active.size( ); ++i )
     {
-      std::cout << "PRE: " << item.first << std::endl;
+      const auto path = active[ i ];
+      const auto first = std::max( _firstSteps[ path ] , begin );
+      const auto last = std::min( _lastSteps[ path ] , end );
+      offsets[ i + 1 ] = offsets[ i ] + ( last > first ? last - first : 0 );
+    }
 
-      const auto& tree = item.second;
-      for ( const auto& rootNode: tree.rootNodes( ))
-      {
-        std::cout << "- " << rootNode->section()->id() <<  std::endl;
+    std::vector< DynamicPathParticle > chunk( offsets.back( ));
 
-        auto path = pathFinder.computeDeepestPathFrom(item.first, rootNode);
+    const int activeCount = static_cast< int >( active.size( ));
 
-        std::cout << "- DISTANCE: " << path.totalDistance() << std::endl;
+#pragma omp parallel for schedule(dynamic, 64)
+    for ( int i = 0; i < activeCount; ++i )
+    {
+      const auto path = active[ i ];
+      const auto first = std::max( _firstSteps[ path ] , begin );
+      const auto last = std::min( _lastSteps[ path ] , end );
 
-        PathGeneratorData data( path , false , 0.0 );
-        walkSection( general , data );
+      if ( path < _paths.size( ))
+      {
+        emitParticles( _paths[ path ] , _step , _velocity , first , last ,
+                       chunk.data( ) + offsets[ i ] );
+        continue;
       }
 
-      std::cout << "Current size: " << general.particles.size() << std::endl;
+      // Instances copy their template, shifted to their first step.
+      const auto pathTemplate = _instances[ path - _paths.size( ) ].pathTemplate;
+      const auto from = _templateParticles.data( ) +
+        _templateOffsets[ pathTemplate ];
+      auto result = chunk.data( ) + offsets[ i ];
+      for ( unsigned int j = first; j < last; ++j )
+      {
+        *result = from[ j - _firstSteps[ path ]];
+        result->timestamp = j * _step;
+        ++result;
+      }
+    }
+
+    if ( chunk.empty( ))
+      return;
+
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    _chunks.push_back( std::move( chunk ));
+  }
+
+  void DynamicPathGenerator::_emitSegmentWindow(
+    const std::vector< unsigned int >& active , unsigned int end )
+  {
+    // Segments are emitted from where the previous window stopped.
+    std::vector< unsigned int > lasts( active.size( ));
+    std::vector< size_t > offsets( active.size( ) + 1 , 0 );
+    for ( size_t i = 0; i < active.size( ); ++i )
+    {
+      const auto path = active[ i ];
+      float time;
+      const auto& source = _source( path , time );
 
+      // Paths leaving the active list emit every remaining segment.
+      lasts[ i ] = _lastSteps[ path ] <= end ?
+        static_cast< unsigned int >( source.size( )) - 1 :
+        segmentFrom( source , time , _velocity , end * _step );
+      lasts[ i ] = std::max( lasts[ i ] , _nextSegments[ path ] );
+
+      offsets[ i + 1 ] = offsets[ i ] + lasts[ i ] - _nextSegments[ path ];
     }
 
-    std::cout << general.particles.size() << std::endl;
-    return std::make_pair( general.particles , general.maxTime );
+    std::vector< DynamicPathSegment > chunk( offsets.back( ));
+
+    const int activeCount = static_cast< int >( active.size( ));
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for ( int i = 0; i < activeCount; ++i )
+    {
+      const auto path = active[ i ];
+      float time;
+      const auto& source = _source( path , time );
+      const bool postsynaptic =
+        path >= _paths.size( ) || _paths[ path ].postsynaptic;
+
+      emitSegments( source , time , postsynaptic , _velocity ,
+                    _nextSegments[ path ] , lasts[ i ] ,
+                    chunk.data( ) + offsets[ i ] );
+      _nextSegments[ path ] = lasts[ i ];
+    }
+
+    if ( chunk.empty( ))
+      return;
+
+    std::lock_guard< std::mutex > lock( _chunksMutex );
+    _segmentChunks.push_back( std::move( chunk ));
   }
 }
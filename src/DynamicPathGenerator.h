@@ -6,72 +6,222 @@
 #define SYNCOPA_DYNAMICPATHGENERATOR_H
 
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include "PathFinder.h"
 #include "particlelab/DynamicPathParticle.h"
+#include "particlelab/DynamicPathSegment.h"
 
 namespace syncopa
 {
 
-  struct PathGeneratorGeneralData
+  //! Part of a segment lit by the pulse, from its oldest point to its newest.
+  struct DynamicPulse
   {
-    PathFinder& pathFinder;
-    std::vector< DynamicPathParticle > particles;
-    float step;
-    float velocity;
-    float maxTime;
-
-    PathGeneratorGeneralData(
-      PathFinder& pathFinder_ , float step_ , float velocity_ )
-      : pathFinder( pathFinder_ )
-      , particles( )
-      , step( step_ )
-      , velocity( velocity_ )
-      , maxTime( 0.0f )
-    { };
+    glm::vec3 tail;
+    glm::vec3 head;
+    float tailAlpha;
+    float headAlpha;
   };
 
+  //! Path crossed by the wavefront, starting at its arrival time.
   struct PathGeneratorData
   {
-    std::unordered_set< uint32_t > visitedSections;
-    utils::EventPolylineInterpolation section;
+    utils::PolylineInterpolation path;
     bool postsynaptic;
     float time;
 
-    PathGeneratorData( utils::EventPolylineInterpolation section_ ,
+    PathGeneratorData( utils::PolylineInterpolation path_ ,
                        bool postsynaptic_ , float time_ )
-      : section( std::move( section_ ))
+      : path( std::move( path_ ))
       , postsynaptic( postsynaptic_ )
       , time( time_ )
     { }
   };
 
+  /*! Generates the particles of the dynamic paths. The arrival time of the
+   * wavefront at every presynaptic section and postsynaptic path is
+   * computed first, in a single preorder traversal of each tree. Particles
+   * are placed where the wavefront is at multiples of the time step, so the
+   * particles of every path form a known range of steps.
+   * Particles are then emitted in the background, one time window after
+   * another, so that the animation can start with the first ones. Windows
+   * start small and double up to a limit. Paths of a window are sampled
+   * concurrently, each writing its own range of the chunk.
+   * In analytic mode the segments of the paths are emitted instead, with
+   * the times the wavefront enters and leaves them, and the pulse is placed
+   * by the vertex shader. Memory then depends on the segments and not on
+   * the time step.
+   * Postsynaptic paths converging to the same soma share the sections
+   * between them and the soma. Every such section is sampled once into a
+   * template, and each walk over it only keeps an instance with its start
+   * time, expanded when its window is emitted. */
   class DynamicPathGenerator
   {
-    static void walkSection(
-      PathGeneratorGeneralData& general , PathGeneratorData& data );
-
-    static void manageEvents(
-      PathGeneratorGeneralData& general ,
-      const PathGeneratorData& data , float distance );
-
-    static void manageNewSection(
-      PathGeneratorGeneralData& general ,
-      const PathGeneratorData& data , uint64_t id );
+  public:
 
-    static void manageSynapse(
-      PathGeneratorGeneralData& general ,
-      const PathGeneratorData& data , uint64_t id );
+    DynamicPathGenerator( void );
+
+    ~DynamicPathGenerator( void );
+
+    /*! Stops any previous generation, computes the arrival times on the
+     * calling thread and starts emitting the particles in the background.
+     * The path finder is not used after returning. If the particles at the
+     * given step exceed budget, the step is increased until they fit.
+     * A zero budget is unlimited. Segments of the analytic mode do not
+     * depend on the step, so the budget does not apply to them. */
+    void start( const PathFinder& pathFinder , float step , float velocity ,
+                size_t budget = 0 );
+
+    //! Cancels the generation, waiting for the background thread.
+    void stop( void );
+
+    //! Emits path segments instead of particles. Used on the next start.
+    void analytic( bool state );
+    bool analytic( void ) const;
+
+    /*! Longest time window of a chunk, zero for the default. Chunks are
+     * drawn only while lit, so windows close to the pulse duration keep
+     * the drawn particles close to the lit ones. Used on the next start. */
+    void windowDuration( float duration );
+
+    //! Time step used by the last start, after fitting the budget.
+    float step( void ) const;
+
+    //! Timestamp of the last particle, known once started.
+    float maxTime( void ) const;
+
+    bool finished( void ) const;
+
+    /*! Moves the chunks published since the previous call to chunks, in
+     * timestamp order. Returns the time before which every particle has
+     * been published. */
+    float takeChunks( std::vector< std::vector< DynamicPathParticle >>& chunks );
+    float takeChunks( std::vector< std::vector< DynamicPathSegment >>& chunks );
+
+    /*! CPU reference of the segment vertex shader. Computes the part of the
+     * segment lit at timestamp, with the alpha the particles at its ends
+     * would have. Returns false if the pulse is not on the segment. */
+    static bool evaluate( const DynamicPathSegment& segment , float timestamp ,
+                          float pulseDuration , DynamicPulse& pulse );
+
+  protected:
+
+    //! Postsynaptic section reached by the wavefront.
+    struct SectionArrival
+    {
+      unsigned int gid;
+      cnode_ptr node;
+      float time;
+    };
+
+    //! Walk over a template, starting at the given time.
+    struct PathInstance
+    {
+      unsigned int pathTemplate;
+      float time;
+    };
+
+    static void computeArrivals(
+      const PathFinder& pathFinder , unsigned int gid ,
+      const ConnectivityTree& tree , float velocity ,
+      std::vector< PathGeneratorData >& result ,
+      std::vector< SectionArrival >& sections );
+
+    //! Steps of the first particle of the path and past its last particle.
+    static void sampleRange(
+      const utils::PolylineInterpolation& path , float time ,
+      float step , float velocity ,
+      unsigned int& first , unsigned int& last );
+
+    //! Writes the particles of the path between both steps.
+    static void emitParticles(
+      const PathGeneratorData& data , float step , float velocity ,
+      unsigned int first , unsigned int last , DynamicPathParticle* result );
 
     static DynamicPathParticle particle(
       const vec3& position , bool postsynaptic , float time );
 
-  public:
+    //! Steps of the start of the first and past the last segment of the path.
+    static void segmentSteps(
+      const utils::PolylineInterpolation& path , float time ,
+      float step , float velocity ,
+      unsigned int& first , unsigned int& last );
+
+    //! First segment of a path started at start, reached at time or later.
+    static unsigned int segmentFrom(
+      const utils::PolylineInterpolation& path , float start ,
+      float velocity , float time );
+
+    static void emitSegments(
+      const utils::PolylineInterpolation& path , float time ,
+      bool postsynaptic , float velocity ,
+      unsigned int first , unsigned int last , DynamicPathSegment* result );
+
+#ifdef DEBUG
+    /*! Whether the head of the pulse evaluated on the segments of the path
+     * is at every particle of the path at its timestamp. */
+    static bool checkEvaluate( const PathGeneratorData& data , float step ,
+                               float velocity );
+#endif
+
+    /*! Sources are the paths followed by the template instances. Returns the
+     * path of a source and the time the wavefront enters it. */
+    const utils::PolylineInterpolation& _source( unsigned int source ,
+                                                 float& time ) const;
+
+    //! Creates the templates of the postsynaptic sections and their instances.
+    void _createInstances( const PathFinder& pathFinder ,
+                           const std::vector< SectionArrival >& sections );
+
+    //! Particles, or segments in analytic mode, at the current step.
+    size_t _count( void ) const;
+
+    void _fitStep( size_t budget );
+
+    void _emitWindows( void );
+
+    void _emitParticleWindow( const std::vector< unsigned int >& active ,
+                              unsigned int begin , unsigned int end );
+
+    void _emitSegmentWindow( const std::vector< unsigned int >& active ,
+                             unsigned int end );
+
+    std::vector< PathGeneratorData > _paths;
+
+    //! Reversed postsynaptic sections and the number of walks over them.
+    std::vector< utils::PolylineInterpolation > _templates;
+    std::vector< unsigned int > _templateUses;
+    std::vector< PathInstance > _instances;
+
+    //! Particles of each template from time zero, in particle mode.
+    std::vector< DynamicPathParticle > _templateParticles;
+    std::vector< size_t > _templateOffsets;
+
+    //! Step range of every source, paths first and then instances.
+    std::vector< unsigned int > _firstSteps;
+    std::vector< unsigned int > _lastSteps;
+    //! Next segment to emit of each source, in analytic mode.
+    std::vector< unsigned int > _nextSegments;
+
+    bool _analytic;
+
+    float _step;
+    float _velocity;
+    float _maxTime;
+    float _windowDuration;
 
-    static std::pair< std::vector< DynamicPathParticle > , float >
-    generateParticles( PathFinder& pathFinder , float step , float velocity );
+    std::thread _thread;
+    std::atomic< bool > _cancel;
 
+    mutable std::mutex _chunksMutex;
+    std::vector< std::vector< DynamicPathParticle >> _chunks;
+    std::vector< std::vector< DynamicPathSegment >> _segmentChunks;
+    float _readyTime;
+    bool _finished;
   };
 }
 
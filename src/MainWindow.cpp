@@ -19,6 +19,8 @@
 #include <QMessageBox>
 #include <QJsonDocument>
 #include <QProgressBar>
+#include <QProgressDialog>
+#include <QEventLoop>
 #include <QDateTime>
 #include <QSurface>
 #include <QUrl>
@@ -31,6 +33,7 @@
 #endif
 
 #include <QJsonObject>
+#include <atomic>
 #include <thread>
 
 #define INITIAL_EGO_NETWORK_DISTANCES 5
@@ -84,6 +87,8 @@ MainWindow::MainWindow(
   , _checkSynapsesPost( nullptr )
   , _checkPathsPre( nullptr )
   , _checkPathsPost( nullptr )
+  , _checkPathsAdaptive( nullptr )
+  , _spinBoxPathsSimplification( nullptr )
   , _colorMapWidget( nullptr )
   , _sliderAlphaSynapsesPre( nullptr )
   , _sliderAlphaSynapsesPost( nullptr )
@@ -97,6 +102,10 @@ MainWindow::MainWindow(
   , _spinBoxSizeSynapsesMap( nullptr )
   , _buttonDynamicStart( nullptr )
   , _buttonDynamicStop( nullptr )
+  , _checkDynamicAnalytic( nullptr )
+  , _spinBoxDynamicVelocity( nullptr )
+  , _spinBoxDynamicBudget( nullptr )
+  , _labelDynamicStep( nullptr )
   , _comboSynapseMapAttrib( nullptr )
   , _sceneLayout( nullptr )
   , _groupBoxGeneral( nullptr )
@@ -122,6 +131,15 @@ MainWindow::MainWindow(
   connect( _ui->actionExport , SIGNAL( triggered( void )) ,
            this , SLOT( exportDataDialog( void )) );
 
+  connect( _ui->actionExportPaths , SIGNAL( triggered( void )) ,
+           this , SLOT( exportPathsDialog( void )) );
+
+  connect( _ui->actionOpenPathChunks , SIGNAL( triggered( void )) ,
+           this , SLOT( openPathChunksDialog( void )) );
+
+  connect( _ui->actionClosePathChunks , SIGNAL( triggered( void )) ,
+           this , SLOT( closePathChunks( void )) );
+
   connect( _ui->actionSyncScene , SIGNAL( triggered( void )) ,
            this , SLOT( syncScene( void )) );
 
@@ -330,6 +348,21 @@ void MainWindow::initColorDock( void )
   _checkPathsPre->setChecked( true );
   _checkPathsPost->setChecked( true );
 
+  _checkPathsAdaptive = new QCheckBox( "Adaptive sampling" );
+  _checkPathsAdaptive->setToolTip(
+    "Space path particles by curvature, keeping them dense near branches "
+    "and synapses." );
+
+  _spinBoxPathsSimplification = new QDoubleSpinBox( );
+  _spinBoxPathsSimplification->setRange( 0.0 , 10.0 );
+  _spinBoxPathsSimplification->setSingleStep( 0.1 );
+  _spinBoxPathsSimplification->setValue( 0.0 );
+  // Every change rebuilds the section geometry, not on each keystroke.
+  _spinBoxPathsSimplification->setKeyboardTracking( false );
+  _spinBoxPathsSimplification->setToolTip(
+    "Largest distance between the simplified and the original sections. "
+    "Zero keeps every node." );
+
   auto layoutGeneral = new QVBoxLayout( );
   auto containerGeneral = new QWidget( );
   containerGeneral->setLayout( layoutGeneral );
@@ -518,6 +551,9 @@ void MainWindow::initColorDock( void )
 
   pathLayout->addWidget( _checkPathsPre , 0 , 0 , 2 , 4 );
   pathLayout->addWidget( _checkPathsPost , 2 , 0 , 2 , 4 );
+  pathLayout->addWidget( _checkPathsAdaptive , 4 , 0 , 1 , 4 );
+  pathLayout->addWidget( new QLabel( "Simplification" ) , 5 , 0 , 1 , 2 );
+  pathLayout->addWidget( _spinBoxPathsSimplification , 5 , 2 , 1 , 2 );
 
   _frameColorDynamicPre = new QPushButton( );
   _frameColorDynamicPre->setFixedSize( 20 , 20 );
@@ -530,6 +566,31 @@ void MainWindow::initColorDock( void )
   _buttonDynamicStart = new QPushButton( "Start" );
   _buttonDynamicStop = new QPushButton( "Stop" );
 
+  _checkDynamicAnalytic = new QCheckBox( "Analytic pulses" );
+  _checkDynamicAnalytic->setToolTip(
+    "Upload path segments and place the pulses in the shader, using less "
+    "memory than one particle per time step." );
+
+  _spinBoxDynamicVelocity = new QDoubleSpinBox( );
+  _spinBoxDynamicVelocity->setRange( 1.0 , 10000.0 );
+  _spinBoxDynamicVelocity->setSingleStep( 10.0 );
+  _spinBoxDynamicVelocity->setValue( 200.0 );
+  // Changes restart the generation, not on each keystroke.
+  _spinBoxDynamicVelocity->setKeyboardTracking( false );
+  _spinBoxDynamicVelocity->setToolTip( "Speed of the pulses along the paths." );
+
+  _spinBoxDynamicBudget = new QDoubleSpinBox( );
+  _spinBoxDynamicBudget->setRange( 0.0 , 1000.0 );
+  _spinBoxDynamicBudget->setDecimals( 0 );
+  _spinBoxDynamicBudget->setKeyboardTracking( false );
+  _spinBoxDynamicBudget->setValue( 20.0 );
+  _spinBoxDynamicBudget->setSuffix( " M" );
+  _spinBoxDynamicBudget->setToolTip(
+    "Largest number of dynamic particles, in millions. The time step is "
+    "increased to stay under it. Zero for no limit." );
+
+  _labelDynamicStep = new QLabel( );
+
   layoutDynamic->addWidget( _frameColorDynamicPre , 0 , 0 , 1 , 1 );
   layoutDynamic->addWidget( new QLabel( "Presynaptic" ) , 0 , 1 , 1 , 1 );
 
@@ -538,6 +599,12 @@ void MainWindow::initColorDock( void )
 
   layoutDynamic->addWidget( _buttonDynamicStart , 0 , 2 , 1 , 1 );
   layoutDynamic->addWidget( _buttonDynamicStop , 1 , 2 , 1 , 1 );
+  layoutDynamic->addWidget( _checkDynamicAnalytic , 2 , 0 , 1 , 3 );
+  layoutDynamic->addWidget( new QLabel( "Velocity" ) , 3 , 0 , 1 , 2 );
+  layoutDynamic->addWidget( _spinBoxDynamicVelocity , 3 , 2 , 1 , 1 );
+  layoutDynamic->addWidget( new QLabel( "Budget" ) , 4 , 0 , 1 , 2 );
+  layoutDynamic->addWidget( _spinBoxDynamicBudget , 4 , 2 , 1 , 1 );
+  layoutDynamic->addWidget( _labelDynamicStep , 5 , 0 , 1 , 3 );
 
   auto tabsWidget = new QTabWidget( );
   tabsWidget->setTabPosition( QTabWidget::West );
@@ -555,10 +622,22 @@ void MainWindow::initColorDock( void )
   connect( _radioAlphaModeNormal , SIGNAL( toggled( bool )) ,
            this , SLOT( alphaModeChanged( bool )) );
 
+  connect( _checkPathsAdaptive , SIGNAL( toggled( bool )) ,
+           this , SLOT( pathsAdaptiveSamplingChanged( bool )) );
+
+  connect( _spinBoxPathsSimplification , SIGNAL( valueChanged( double )) ,
+           this , SLOT( pathsSimplificationChanged( double )) );
+
   connect( _buttonDynamicStart , SIGNAL( clicked( )) , this ,
            SLOT( dynamicStart( )) );
   connect( _buttonDynamicStop , SIGNAL( clicked( )) , this ,
            SLOT( dynamicStop( )) );
+  connect( _checkDynamicAnalytic , SIGNAL( toggled( bool )) ,
+           this , SLOT( dynamicAnalyticChanged( bool )) );
+  connect( _spinBoxDynamicVelocity , SIGNAL( valueChanged( double )) ,
+           this , SLOT( dynamicVelocityChanged( double )) );
+  connect( _spinBoxDynamicBudget , SIGNAL( valueChanged( double )) ,
+           this , SLOT( dynamicBudgetChanged( double )) );
 
   connect( _frameColorSynapsesPre , SIGNAL( clicked( )) ,
            this , SLOT( colorSelectionClicked( )) );
@@ -947,30 +1026,32 @@ void MainWindow::loadPresynapticList( void )
 
 void MainWindow::loadPostsynapticList( std::vector<unsigned int> gid )
 {
-  auto nsolData = _openGLWidget->dataset( );
+  const auto& synapseIndex =
+    _openGLWidget->getDomainManager( )->synapseIndex( );
 
   _modelListPost->clear( );
 
-  std::set< unsigned int > selection;
-  selection.insert(gid.begin(), gid.end());
-  const auto synapses = nsolData->circuit( ).synapses( selection ,
-                                                       nsol::Circuit::PRESYNAPTICCONNECTIONS );
+  std::set< unsigned int > presynaptic;
+  presynaptic.insert(gid.begin(), gid.end());
 
-  selection.clear( );
+  std::set< unsigned int > selection;
 
   QList< QStandardItem* > items;
-  for ( const auto& syn: synapses )
+  for ( const auto preGid: presynaptic )
   {
-    unsigned int postGid = syn->postSynapticNeuron( );
-    if ( selection.find( postGid ) != selection.end( ))
-      continue;
+    for ( const auto& syn: synapseIndex.presynaptic( preGid ))
+    {
+      unsigned int postGid = syn->postSynapticNeuron( );
+      if ( selection.find( postGid ) != selection.end( ))
+        continue;
 
-    auto item = new QStandardItem( );
-    item->setData( postGid , Qt::DisplayRole );
+      auto item = new QStandardItem( );
+      item->setData( postGid , Qt::DisplayRole );
 
-    items << item;
+      items << item;
 
-    selection.insert( postGid );
+      selection.insert( postGid );
+    }
   }
 
   _modelListPost->appendColumn( items );
@@ -1029,6 +1110,86 @@ void MainWindow::exportDataDialog( void )
   QApplication::restoreOverrideCursor( );
 }
 
+void MainWindow::exportPathsDialog( void )
+{
+  if ( !_openGLWidget->dataset( )) return;
+
+  const QString filename = QFileDialog::getSaveFileName(
+    this , tr( "Export paths..." ) , tr( "paths.sypk" ) ,
+    tr( "Path chunks (*.sypk)" ) ,
+    nullptr , QFileDialog::DontUseNativeDialog );
+
+  if ( filename.isEmpty( )) return;
+
+  const auto neurons =
+    static_cast< int >( _openGLWidget->dataset( )->neurons( ).size( ));
+
+  // Modal, so that the selection does not change while exporting.
+  QProgressDialog progress( tr( "Exporting paths..." ) , tr( "Cancel" ) ,
+                            0 , neurons , this );
+  progress.setWindowModality( Qt::WindowModal );
+  progress.setAutoReset( false );
+  progress.setMinimumDuration( 0 );
+
+  std::atomic< bool > cancel( false );
+  std::atomic< size_t > exported( 0 );
+  std::atomic< bool > finished( false );
+  bool result = false;
+
+  std::thread worker( [ & ]( )
+  {
+    result = _openGLWidget->exportPaths( filename.toStdString( ) ,
+      [ & ]( size_t neuronCount )
+      {
+        exported = neuronCount;
+        return !cancel;
+      } );
+    finished = true;
+  } );
+
+  QEventLoop loop;
+  QTimer timer;
+  connect( &timer , &QTimer::timeout , [ & ]( )
+  {
+    if ( progress.wasCanceled( ))
+      cancel = true;
+    else
+      progress.setValue( static_cast< int >( exported ));
+
+    if ( finished )
+      loop.quit( );
+  } );
+  timer.start( 100 );
+  loop.exec( );
+
+  worker.join( );
+
+  if ( !result && !cancel )
+    std::cerr << "Couldn't export paths to " << filename.toStdString( )
+              << std::endl;
+}
+
+void MainWindow::openPathChunksDialog( void )
+{
+  const QString filename = QFileDialog::getOpenFileName(
+    this , tr( "Open path chunks" ) , _lastOpenedFileNamePath ,
+    tr( "Path chunks (*.sypk);; All files (*)" ) ,
+    nullptr , QFileDialog::DontUseNativeDialog );
+
+  if ( filename.isEmpty( )) return;
+
+  _openGLWidget->openPathChunks( filename.toStdString( ));
+  _ui->actionClosePathChunks->setEnabled( _openGLWidget->pathChunksOpen( ));
+}
+
+void MainWindow::closePathChunks( void )
+{
+  _openGLWidget->closePathChunks( );
+  _ui->actionClosePathChunks->setEnabled( false );
+
+  _openGLWidget->updatePathsModel( _neuronClusterManager );
+}
+
 void MainWindow::syncScene( )
 {
   const auto dataset = _openGLWidget->dataset( );
@@ -1440,6 +1601,7 @@ void MainWindow::dynamicStart( void )
     _buttonDynamicStart->setText( "Pause" );
     _buttonDynamicStop->setEnabled( true );
     _openGLWidget->startDynamic( );
+    _updateDynamicStep( );
   }
   else
   {
@@ -1463,7 +1625,38 @@ void MainWindow::dynamicStop( void )
     _buttonDynamicStart->setText( "Start" );
 
     _openGLWidget->stopDynamic( );
+    _updateDynamicStep( );
+  }
+}
+
+void MainWindow::dynamicAnalyticChanged( bool state )
+{
+  _openGLWidget->dynamicAnalytic( state );
+  _updateDynamicStep( );
+}
+
+void MainWindow::dynamicVelocityChanged( double velocity )
+{
+  _openGLWidget->dynamicVelocity( static_cast< float >( velocity ));
+  _updateDynamicStep( );
+}
+
+void MainWindow::dynamicBudgetChanged( double particles )
+{
+  _openGLWidget->dynamicBudget( static_cast< size_t >( particles * 1e6 ));
+  _updateDynamicStep( );
+}
+
+void MainWindow::_updateDynamicStep( void )
+{
+  if ( !_openGLWidget->dynamicActive( ))
+  {
+    _labelDynamicStep->clear( );
+    return;
   }
+
+  _labelDynamicStep->setText(
+    QString( "Time step: %1" ).arg( _openGLWidget->dynamicStep( )));
 }
 
 void MainWindow::filteringStateChanged( void )
@@ -1521,6 +1714,18 @@ void MainWindow::alphaModeChanged( bool state )
   _openGLWidget->alphaMode( !state );
 }
 
+void MainWindow::pathsAdaptiveSamplingChanged( bool state )
+{
+  _openGLWidget->pathsAdaptiveSampling( state );
+  _openGLWidget->updatePathsModel( _neuronClusterManager );
+}
+
+void MainWindow::pathsSimplificationChanged( double tolerance )
+{
+  _openGLWidget->pathsSimplification( static_cast< float >( tolerance ));
+  _openGLWidget->updatePathsModel( _neuronClusterManager );
+}
+
 void MainWindow::neuronClusterManagerStructureRefresh( )
 {
   while ( auto* item = _sceneLayout->takeAt( 0 ))
@@ -23,6 +23,7 @@
 #include <QDoubleSpinBox>
 #include <QComboBox>
 #include <QCheckBox>
+#include <QLabel>
 #include <QGroupBox>
 #include <QPolygonF>
 #include <QThread>
@@ -170,6 +171,12 @@ protected slots:
 
     void exportDataDialog(void);
 
+    void exportPathsDialog(void);
+
+    void openPathChunksDialog(void);
+
+    void closePathChunks(void);
+
     void syncScene(void);
 
     void presynapticNeuronClicked();
@@ -198,6 +205,10 @@ protected slots:
 
     void alphaModeChanged(bool state);
 
+    void pathsAdaptiveSamplingChanged(bool state);
+
+    void pathsSimplificationChanged(double tolerance);
+
     void clear(void);
 
     void dynamicStart(void);
@@ -206,6 +217,12 @@ protected slots:
 
     void dynamicStop(void);
 
+    void dynamicAnalyticChanged(bool state);
+
+    void dynamicVelocityChanged(double velocity);
+
+    void dynamicBudgetChanged(double particles);
+
     void neuronClusterManagerStructureRefresh(void);
 
     void neuronClusterManagerMetadataRefresh(void);
@@ -253,6 +270,8 @@ protected:
 
     void _loadDefaultValues(void);
 
+    void _updateDynamicStep(void);
+
     /** \brief Helper method to enable/disable the interface.
      *
      */
@@ -292,6 +311,8 @@ protected:
     QGroupBox* _checkSynapsesPost;
     QGroupBox* _checkPathsPre;
     QGroupBox* _checkPathsPost;
+    QCheckBox* _checkPathsAdaptive;
+    QDoubleSpinBox* _spinBoxPathsSimplification;
 
     std::vector<std::tuple<QPushButton*, QPushButton*, QCheckBox*>>
     _egoNetworkButtons;
@@ -319,6 +340,10 @@ protected:
     QPushButton* _frameColorDynamicPost;
     QPushButton* _buttonDynamicStart;
     QPushButton* _buttonDynamicStop;
+    QCheckBox* _checkDynamicAnalytic;
+    QDoubleSpinBox* _spinBoxDynamicVelocity;
+    QDoubleSpinBox* _spinBoxDynamicBudget;
+    QLabel* _labelDynamicStep;
 
     QComboBox* _comboSynapseMapAttrib;
 
@@ -15,6 +15,7 @@
 #include <QDebug>
 
 #include <string>
+#include <cstdio>
 #include <iostream>
 #include <glm/glm.hpp>
 
@@ -57,10 +58,16 @@ OpenGLWidget::OpenGLWidget(
   , _domainManager( nullptr )
   , _mode( UNDEFINED )
   , _particleSizeThreshold( 0.45 )
+  , _pathChunksView( Eigen::Matrix4f::Zero( ))
+  , _pathChunksBudget( 20000000 )
   , _elapsedTimeRenderAcc( 0.0f )
   , _alphaSynapsesMap( 0.55 )
   , _dynamicActive( false )
   , _dynamicMovement( true )
+  , _dynamicStep( 0.002f )
+  , _dynamicVelocity( 200.0f )
+  , _dynamicBudget( 20000000 )
+  , _dynamicReadyTime( 0.0f )
   , _oglFunctions( nullptr )
   , _screenPlaneShader( nullptr )
   , _quadVAO( 0 )
@@ -208,9 +215,6 @@ void OpenGLWidget::loadBlueConfig( const std::string& blueConfigFilePath ,
 
   _domainManager->dataset( _dataset );
 
-  emit progress( tr( "Configuring path finder" ) , 100 );
-  _pathFinder.dataset( _dataset , &_domainManager->synapsesInfo( ));
-
   _neuronScene = new syncopa::NeuronScene( _dataset );
 
   connect(
@@ -222,6 +226,23 @@ void OpenGLWidget::loadBlueConfig( const std::string& blueConfigFilePath ,
 
   _neuronScene->generateMeshes( );
 
+  // Section geometry is flattened from the simplified morphologies.
+  emit progress( tr( "Configuring path finder" ) , 100 );
+  _pathFinder.dataset( _dataset , &_domainManager->synapsesInfo( ) ,
+                       &_domainManager->synapseIndex( ));
+
+  // Cached path particles are only valid for the same circuit and target,
+  // while none of its files change.
+  std::vector< std::string > cacheSources{ blueConfigFilePath };
+  if ( const auto blueConfig = _dataset->blueConfig( ))
+  {
+    cacheSources.push_back( blueConfig->getCircuitSource( ).getPath( ));
+    cacheSources.push_back( blueConfig->getSynapseSource( ).getPath( ));
+    cacheSources.push_back( blueConfig->getMorphologySource( ).getPath( ));
+  }
+  _pathCache.open( blueConfigFilePath + ":" + target , cacheSources );
+  _pathFinder.cache( &_pathCache );
+
   emit progress( QString( ) , 100 );
 }
 
@@ -244,8 +265,13 @@ void OpenGLWidget::setupSynapses( void )
 
 void OpenGLWidget::setupPaths( void )
 {
+  // Chunk files replace the paths of the selection until closed.
+  if ( _pathChunks.isOpen( ))
+    return;
+
   if ( _mode != PATHS )
   {
+    _pathFinder.clear( );
     _particleManager.clearPaths( );
     return;
   }
@@ -418,6 +444,10 @@ void OpenGLWidget::updateSynapsesModel(
 void OpenGLWidget::updatePathsModel(
   std::shared_ptr< syncopa::NeuronClusterManager > manager )
 {
+  // Selection paths are configured again once the chunk file is closed.
+  if ( _pathChunks.isOpen( ))
+    return;
+
   std::unordered_set< unsigned int > preNeuronsWithAllPaths;
   std::unordered_set< unsigned int > preNeuronsWithConnectedPaths;
 
@@ -487,6 +517,7 @@ void OpenGLWidget::updatePathsModel(
 
   if ( empty )
   {
+    _pathFinder.clear( );
     _particleManager.clearPaths( );
   }
   else
@@ -496,26 +527,32 @@ void OpenGLWidget::updatePathsModel(
     const float pointSize =
       _particleManager.getPathModel( )->getParticlePreSize( ) *
       _particleSizeThreshold * 0.5f;
-    auto& synapses = _dataset->circuit( ).synapses( );
-
-    tsynapseVec outUsedSynapses;
-    tsynapseVec outUsedPreSynapses;
-    tsynapseVec outUsedPostSynapses;
-    std::vector< vec3 > preOut;
-    std::vector< vec3 > postOut;
+    std::vector< unsigned int > removedNeurons;
+    std::vector< unsigned int > updatedNeurons;
 
     _pathFinder.configure(
-      synapses ,
       preNeuronsWithAllPaths ,
       postNeuronsWithAllPaths ,
       preNeuronsWithConnectedPaths ,
       postNeuronsWithConnectedPaths ,
       pointSize ,
-      preOut ,
-      postOut
+      removedNeurons ,
+      updatedNeurons
     );
 
-    _particleManager.setPaths( preOut , postOut );
+    // Only neurons whose paths changed are touched.
+    for ( const auto gid: removedNeurons )
+      _particleManager.removeNeuronPaths( gid );
+
+    for ( const auto gid: updatedNeurons )
+    {
+      const auto paths = _pathFinder.neuronPaths( gid );
+      if ( paths )
+        _particleManager.setNeuronPaths( gid , paths->preOut ,
+                                         paths->postOut );
+    }
+
+    _particleManager.updatePaths( );
   }
 }
 
@@ -684,6 +721,9 @@ void OpenGLWidget::paintMorphologies( void )
 
 void OpenGLWidget::paintParticles( void )
 {
+  if ( _mode == PATHS && _pathChunks.isOpen( ))
+    pagePathChunks( );
+
   const auto pos = _camera->position( );
   glm::vec3 cameraPosition( pos[ 0 ] , pos[ 1 ] , pos[ 2 ] );
   _lastCameraPosition = cameraPosition;
@@ -723,10 +763,18 @@ void OpenGLWidget::paintGL( void )
 
       if ( _elapsedTimeRenderAcc >= _renderPeriodMicroseconds )
       {
+        if ( _dynamicActive )
+          updateDynamic( );
+
         if ( _dynamicMovement )
         {
-          const float delta = _elapsedTimeRenderAcc * 0.000001;
-          _particleManager.getDynamicModel( )->addTime( delta );
+          const auto& model = _particleManager.getDynamicModel( );
+
+          // Waits for the particles still being generated.
+          float delta = _elapsedTimeRenderAcc * 0.000001;
+          delta = std::min( delta , std::max(
+            0.0f , _dynamicReadyTime - model->getTimestamp( )));
+          model->addTime( delta );
         }
         _elapsedTimeRenderAcc = 0.0f;
       }
@@ -1221,14 +1269,19 @@ void OpenGLWidget::startDynamic( void )
     return;
 
   stopDynamic( );
-  auto particles = DynamicPathGenerator::generateParticles(
-    _pathFinder , 0.002f , 200.0f );
+  _pathFinder.prepareDynamicPaths( );
 
   auto& model = _particleManager.getDynamicModel( );
-  model->setMaxTime( particles.second );
-  model->setTimestamp( 0.0f );
 
-  _particleManager.setDynamic( particles.first );
+  // Particles are uploaded by paintGL as they are generated, in chunks
+  // drawn only while lit.
+  _dynamicGenerator.windowDuration( model->getPulseDuration( ));
+  _dynamicGenerator.start( _pathFinder , _dynamicStep , _dynamicVelocity ,
+                           _dynamicBudget );
+  _dynamicReadyTime = 0.0f;
+
+  model->setMaxTime( _dynamicGenerator.maxTime( ));
+  model->setTimestamp( 0.0f );
 
   _dynamicMovement = true;
   _dynamicActive = true;
@@ -1241,8 +1294,56 @@ bool OpenGLWidget::toggleDynamicMovement( void )
   return _dynamicMovement;
 }
 
+void OpenGLWidget::dynamicAnalytic( bool state )
+{
+  if ( state == _dynamicGenerator.analytic( ))
+    return;
+
+  _dynamicGenerator.analytic( state );
+  restartDynamic( );
+}
+
+void OpenGLWidget::dynamicVelocity( float velocity )
+{
+  _dynamicVelocity = velocity;
+  restartDynamic( );
+}
+
+float OpenGLWidget::dynamicVelocity( void ) const
+{
+  return _dynamicVelocity;
+}
+
+void OpenGLWidget::dynamicBudget( size_t particles )
+{
+  _dynamicBudget = particles;
+  restartDynamic( );
+}
+
+size_t OpenGLWidget::dynamicBudget( void ) const
+{
+  return _dynamicBudget;
+}
+
+float OpenGLWidget::dynamicStep( void ) const
+{
+  return _dynamicGenerator.step( );
+}
+
+void OpenGLWidget::restartDynamic( void )
+{
+  if ( !_dynamicActive )
+    return;
+
+  const bool movement = _dynamicMovement;
+  stopDynamic( );
+  startDynamic( );
+  _dynamicMovement = movement;
+}
+
 void OpenGLWidget::stopDynamic( void )
 {
+  _dynamicGenerator.stop( );
   _particleManager.clearDynamic( );
   _dynamicActive = false;
 }
@@ -1306,6 +1407,159 @@ void OpenGLWidget::alphaMode( bool alphaAccumulative )
   update( );
 }
 
+void OpenGLWidget::pathsAdaptiveSampling( bool state )
+{
+  _pathFinder.adaptiveSampling( state );
+}
+
+bool OpenGLWidget::exportPaths(
+  const std::string& filePath ,
+  const std::function< bool( size_t ) >& progress )
+{
+  if ( !_dataset )
+    return false;
+
+  // Cells of 50 micrometers, flushing every 16M particles.
+  syncopa::PathChunkWriter writer;
+  if ( !writer.open( filePath , 50.0f , 16000000 ))
+    return false;
+
+  syncopa::gidVec gids;
+  gids.reserve( _dataset->neurons( ).size( ));
+  for ( const auto& neuron: _dataset->neurons( ))
+    gids.push_back( neuron.first );
+
+  const float pointSize =
+    _particleManager.getPathModel( )->getParticlePreSize( ) *
+    _particleSizeThreshold * 0.5f;
+
+  if ( !_pathFinder.exportPaths( gids , writer , pointSize , 256 , progress ))
+  {
+    writer.close( );
+    std::remove( filePath.c_str( ));
+    return false;
+  }
+
+  return writer.close( );
+}
+
+bool OpenGLWidget::openPathChunks( const std::string& filePath )
+{
+  closePathChunks( );
+
+  if ( !_pathChunks.open( filePath ))
+  {
+    setupPaths( );
+    return false;
+  }
+
+  _pathFinder.clear( );
+  _particleManager.clearPaths( );
+  _pathChunksView = Eigen::Matrix4f::Zero( );
+
+  update( );
+
+  return true;
+}
+
+void OpenGLWidget::closePathChunks( void )
+{
+  if ( !_pathChunks.isOpen( ))
+    return;
+
+  _pathChunks.close( );
+  _residentPathChunks.clear( );
+  _particleManager.clearPathChunks( );
+
+  setupPaths( );
+  update( );
+}
+
+bool OpenGLWidget::pathChunksOpen( void ) const
+{
+  return _pathChunks.isOpen( );
+}
+
+void OpenGLWidget::updateDynamic( void )
+{
+  if ( _dynamicGenerator.analytic( ))
+  {
+    std::vector< std::vector< DynamicPathSegment >> chunks;
+    _dynamicReadyTime = _dynamicGenerator.takeChunks( chunks );
+
+    for ( const auto& chunk: chunks )
+      _particleManager.addDynamic( chunk );
+  }
+  else
+  {
+    std::vector< std::vector< DynamicPathParticle >> chunks;
+    _dynamicReadyTime = _dynamicGenerator.takeChunks( chunks );
+
+    for ( const auto& chunk: chunks )
+      _particleManager.addDynamic( chunk );
+  }
+}
+
+void OpenGLWidget::pagePathChunks( void )
+{
+  const Eigen::Matrix4f projection( _camera->camera( )->projectionMatrix( ));
+  const Eigen::Matrix4f view( _camera->camera( )->viewMatrix( ));
+  const Eigen::Matrix4f viewProjection = projection * view;
+
+  if ( viewProjection == _pathChunksView )
+    return;
+
+  _pathChunksView = viewProjection;
+
+  const auto position = _camera->position( );
+  const auto visible = _pathChunks.visibleChunks(
+    viewProjection , vec3( position[ 0 ] , position[ 1 ] , position[ 2 ] ));
+
+  // Nearest chunks first, until the budget is filled.
+  std::unordered_set< unsigned int > wanted;
+  size_t particles = 0;
+  for ( const auto chunk: visible )
+  {
+    const auto count = _pathChunks.chunks( )[ chunk ].count;
+    if ( particles + count > _pathChunksBudget )
+      break;
+
+    particles += count;
+    wanted.insert( chunk );
+  }
+
+  // Chunks have their own buffers, only the new ones are uploaded.
+  for ( auto it = _residentPathChunks.begin( );
+        it != _residentPathChunks.end( ); )
+  {
+    if ( wanted.find( *it ) != wanted.end( ))
+    {
+      ++it;
+      continue;
+    }
+
+    _particleManager.removePathChunk( *it );
+    it = _residentPathChunks.erase( it );
+  }
+
+  std::vector< vec3 > chunkParticles;
+  for ( const auto chunk: wanted )
+  {
+    if ( !_residentPathChunks.insert( chunk ).second )
+      continue;
+
+    _pathChunks.read( chunk , chunkParticles );
+    _particleManager.setPathChunk(
+      chunk , chunkParticles ,
+      _pathChunks.chunks( )[ chunk ].type == syncopa::POSTSYNAPTIC );
+  }
+}
+
+void OpenGLWidget::pathsSimplification( float tolerance )
+{
+  _pathFinder.simplification( tolerance );
+}
+
 void OpenGLWidget::mode( TMode mode_ )
 {
   _mode = mode_;
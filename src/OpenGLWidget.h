@@ -75,6 +75,28 @@ public:
 
   void alphaMode( bool alphaAccumulative = false );
 
+  //! Takes effect on the next updatePathsModel.
+  void pathsAdaptiveSampling( bool state );
+
+  //! Takes effect on the next updatePathsModel.
+  void pathsSimplification( float tolerance );
+
+  /*! Writes the paths of every neuron of the dataset to a chunk file. Safe
+   * to call from a worker thread while the selection does not change.
+   * progress receives the neurons written so far and cancels the export
+   * returning false, in which case the file is removed. */
+  bool exportPaths( const std::string& filePath ,
+                    const std::function< bool( size_t ) >& progress );
+
+  /*! Shows the paths of a chunk file instead of the selection ones. Chunks
+   * inside the view are paged in while the camera moves. */
+  bool openPathChunks( const std::string& filePath );
+
+  //! Selection paths are shown again on the next updatePathsModel.
+  void closePathChunks( void );
+
+  bool pathChunksOpen( void ) const;
+
   void mode( syncopa::TMode mode_ );
 
   syncopa::TMode mode( ) const;
@@ -191,6 +213,19 @@ public slots:
 
   void stopDynamic( );
 
+  //! Places the pulses along path segments in the shader.
+  void dynamicAnalytic( bool state );
+
+  void dynamicVelocity( float velocity );
+  float dynamicVelocity( void ) const;
+
+  //! Largest number of dynamic particles, zero for no limit.
+  void dynamicBudget( size_t particles );
+  size_t dynamicBudget( void ) const;
+
+  //! Time step of the running dynamic paths, coarser if over the budget.
+  float dynamicStep( void ) const;
+
   const QPolygonF& getSynapseMappingPlot( ) const;
 
   void filteringState( bool state );
@@ -232,8 +267,17 @@ protected:
 
   void setupPaths( );
 
+  //! Loads the visible path chunks, up to the particle budget.
+  void pagePathChunks( void );
+
   void paintParticles( );
 
+  //! Uploads the dynamic particles generated since the previous frame.
+  void updateDynamic( void );
+
+  //! Generates the dynamic paths again, if running, with the new settings.
+  void restartDynamic( void );
+
   void paintMorphologies( );
 
   void initRenderToTexture( );
@@ -265,7 +309,13 @@ protected:
 
   nsol::DataSet* _dataset;
   syncopa::ParticleManager _particleManager;
+  syncopa::PathCache _pathCache;
   syncopa::PathFinder _pathFinder;
+
+  syncopa::PathChunkReader _pathChunks;
+  std::unordered_set< unsigned int > _residentPathChunks;
+  Eigen::Matrix4f _pathChunksView;
+  size_t _pathChunksBudget;
   syncopa::NeuronScene* _neuronScene;
   syncopa::DomainManager* _domainManager;
 
@@ -289,6 +339,13 @@ protected:
   bool _dynamicActive;
   bool _dynamicMovement;
 
+  syncopa::DynamicPathGenerator _dynamicGenerator;
+  float _dynamicStep;
+  float _dynamicVelocity;
+  size_t _dynamicBudget;
+  //! Time before which every dynamic particle has been uploaded.
+  float _dynamicReadyTime;
+
   std::vector< nsol::MorphologySynapsePtr > _currentSynapses;
 
   // Render to texture
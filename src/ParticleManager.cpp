@@ -26,6 +26,7 @@ namespace syncopa
     , _pathCluster( nullptr )
     , _pathModel( nullptr )
     , _pathBB( )
+    , _compactPaths( false )
     , _gradientMode( false )
   {
   }
@@ -44,6 +45,10 @@ namespace syncopa
                                   PARTICLE_FRAGMENT_SHADER );
     _dynamicProgram.compileAndLink( );
 
+    _dynamicSegmentProgram.loadFromText( DYNAMIC_SEGMENT_VERTEX_SHADER ,
+                                         PARTICLE_FRAGMENT_SHADER );
+    _dynamicSegmentProgram.compileAndLink( );
+
     _staticAccProgram.loadFromText( STATIC_VERTEX_SHADER ,
                                     PARTICLE_ACC_FRAGMENT_SHADER );
     _staticAccProgram.compileAndLink( );
@@ -56,6 +61,10 @@ namespace syncopa
                                      PARTICLE_ACC_FRAGMENT_SHADER );
     _dynamicAccProgram.compileAndLink( );
 
+    _dynamicSegmentAccProgram.loadFromText( DYNAMIC_SEGMENT_VERTEX_SHADER ,
+                                            PARTICLE_ACC_FRAGMENT_SHADER );
+    _dynamicSegmentAccProgram.compileAndLink( );
+
     _staticRenderer = std::make_shared< plab::SimpleRenderer >(
       _staticProgram.program( ));
 
@@ -65,6 +74,9 @@ namespace syncopa
     _dynamicRenderer = std::make_shared< plab::SimpleRenderer >(
       _dynamicProgram.program( ));
 
+    _dynamicSegmentRenderer = std::make_shared< plab::SimpleRenderer >(
+      _dynamicSegmentProgram.program( ));
+
     _staticAccRenderer = std::make_shared< plab::SimpleRenderer >(
       _staticAccProgram.program( ));
 
@@ -74,6 +86,9 @@ namespace syncopa
     _dynamicAccRenderer = std::make_shared< plab::SimpleRenderer >(
       _dynamicAccProgram.program( ));
 
+    _dynamicSegmentAccRenderer = std::make_shared< plab::SimpleRenderer >(
+      _dynamicSegmentAccProgram.program( ));
+
     // SYNAPSES
     _synapseCluster = std::make_shared< plab::Cluster< SynapseParticle >>( );
     _synapseModel = std::make_shared< StaticModel >(
@@ -94,14 +109,10 @@ namespace syncopa
     _pathCluster->setRenderer( _staticRenderer );
 
     // DYNAMIC
-    _dynamicCluster = std::make_shared< plab::Cluster< DynamicPathParticle>>( );
     _dynamicModel = std::make_shared< DynamicModel >(
       camera , 8.0f , 8.0f , glm::vec4( 1.0f ) ,
       glm::vec4( 1.0f ) , true , true , 0.0f , 0.0f , 0.5f
     );
-
-    _dynamicCluster->setModel( _dynamicModel );
-    _dynamicCluster->setRenderer( _dynamicRenderer );
   }
 
   const std::shared_ptr< StaticModel >&
@@ -161,14 +172,24 @@ namespace syncopa
     if ( accumulativeMode )
     {
       _pathCluster->setRenderer( _staticAccRenderer );
-      _dynamicCluster->setRenderer( _dynamicAccRenderer );
+      for ( const auto& chunk: _pathChunkClusters )
+        chunk.second->setRenderer( _staticAccRenderer );
+      for ( const auto& chunk: _dynamicClusters )
+        chunk.cluster->setRenderer( _dynamicAccRenderer );
+      for ( const auto& chunk: _dynamicSegmentClusters )
+        chunk.cluster->setRenderer( _dynamicSegmentAccRenderer );
       _synapseCluster->setRenderer(
         _gradientMode ? _staticAccGradientRenderer : _staticAccRenderer );
     }
     else
     {
       _pathCluster->setRenderer( _staticRenderer );
-      _dynamicCluster->setRenderer( _dynamicRenderer );
+      for ( const auto& chunk: _pathChunkClusters )
+        chunk.second->setRenderer( _staticRenderer );
+      for ( const auto& chunk: _dynamicClusters )
+        chunk.cluster->setRenderer( _dynamicRenderer );
+      for ( const auto& chunk: _dynamicSegmentClusters )
+        chunk.cluster->setRenderer( _dynamicSegmentRenderer );
       _synapseCluster->setRenderer(
         _gradientMode ? _staticGradientRenderer : _staticRenderer );
     }
@@ -256,48 +277,172 @@ namespace syncopa
     _gradientMode = false;
   }
 
-  void ParticleManager::setPaths(
-    const std::vector< vec3 >& pre , const std::vector< vec3 >& post )
+  void ParticleManager::setNeuronPaths( unsigned int gid ,
+                                        const std::vector< vec3 >& pre ,
+                                        const std::vector< vec3 >& post )
   {
-    std::vector< SynapseParticle > particles;
+    removeNeuronPaths( gid );
 
-    float minLimit = std::numeric_limits< float >::min( );
-    float maxLimit = std::numeric_limits< float >::max( );
-    glm::vec3 min( maxLimit , maxLimit , maxLimit );
-    glm::vec3 max( minLimit , minLimit , minLimit );
+    const float maxLimit = std::numeric_limits< float >::max( );
 
-    for ( const auto& pos: pre )
+    NeuronPathRange range;
+    range.offset = _pathParticles.size( );
+    range.size = pre.size( ) + post.size( );
+    range.min = glm::vec3( maxLimit , maxLimit , maxLimit );
+    range.max = glm::vec3( -maxLimit , -maxLimit , -maxLimit );
+
+    _pathParticles.reserve( range.offset + range.size );
+
+    auto addParticles = [ & ]( const std::vector< vec3 >& positions ,
+                               float isPostsynaptic )
     {
-      SynapseParticle particle = SynapseParticle( );
-      particle.position = eigenToGLM( pos );
-      particle.isPostsynaptic = 0;
-      particles.push_back( particle );
+      for ( const auto& pos: positions )
+      {
+        SynapseParticle particle = SynapseParticle( );
+        particle.position = eigenToGLM( pos );
+        particle.isPostsynaptic = isPostsynaptic;
+        _pathParticles.push_back( particle );
+
+        range.min = glm::min( range.min , particle.position );
+        range.max = glm::max( range.max , particle.position );
+      }
+    };
+
+    addParticles( pre , 0 );
+    addParticles( post , 1 );
+
+    _neuronPaths.insert( std::make_pair( gid , range ));
+  }
+
+  void ParticleManager::removeNeuronPaths( unsigned int gid )
+  {
+    // Particles are left in place until the next upload.
+    if ( _neuronPaths.erase( gid ) > 0 )
+      _compactPaths = true;
+  }
+
+  void ParticleManager::updatePaths( )
+  {
+    if ( _compactPaths )
+    {
+      size_t size = 0;
+      for ( const auto& item: _neuronPaths )
+        size += item.second.size;
 
-      min = glm::min( min , particle.position );
-      max = glm::max( max , particle.position );
+      std::vector< SynapseParticle > particles;
+      particles.reserve( size );
+
+      for ( auto& item: _neuronPaths )
+      {
+        auto& range = item.second;
+        const auto first = _pathParticles.cbegin( ) + range.offset;
+
+        range.offset = particles.size( );
+        particles.insert( particles.end( ) , first , first + range.size );
+      }
+
+      _pathParticles.swap( particles );
+      _compactPaths = false;
     }
 
-    for ( const auto& pos: post )
+    if ( _pathParticles.empty( ))
     {
-      SynapseParticle particle = SynapseParticle( );
-      particle.position = eigenToGLM( pos );
-      particle.isPostsynaptic = 1;
-      particles.push_back( particle );
+      _pathCluster->allocateBuffer( 0 );
+      return;
+    }
+
+    const float maxLimit = std::numeric_limits< float >::max( );
+    glm::vec3 min( maxLimit , maxLimit , maxLimit );
+    glm::vec3 max( -maxLimit , -maxLimit , -maxLimit );
+
+    for ( const auto& item: _neuronPaths )
+    {
+      if ( item.second.size == 0 )
+        continue;
 
-      min = glm::min( min , particle.position );
-      max = glm::max( max , particle.position );
+      min = glm::min( min , item.second.min );
+      max = glm::max( max , item.second.max );
     }
 
     _pathBB.minimum( ) = glmToEigen( min );
     _pathBB.maximum( ) = glmToEigen( max );
     recalculateParticlesBoundingBox( );
-    _pathCluster->setParticles( particles );
+    _pathCluster->setParticles( _pathParticles );
+  }
+
+  void ParticleManager::setPathChunk( unsigned int chunk ,
+                                      const std::vector< vec3 >& positions ,
+                                      bool postsynaptic )
+  {
+    std::vector< SynapseParticle > particles;
+    particles.reserve( positions.size( ));
+    for ( const auto& pos: positions )
+    {
+      SynapseParticle particle = SynapseParticle( );
+      particle.position = eigenToGLM( pos );
+      particle.isPostsynaptic = postsynaptic ? 1 : 0;
+      particles.push_back( particle );
+    }
+
+    auto cluster = std::make_shared< plab::Cluster< SynapseParticle >>( );
+    cluster->setModel( _pathModel );
+    cluster->setRenderer( isAccumulativeMode( ) ?
+                          _staticAccRenderer : _staticRenderer );
+    cluster->setParticles( particles );
+
+    _pathChunkClusters[ chunk ] = cluster;
+  }
+
+  void ParticleManager::removePathChunk( unsigned int chunk )
+  {
+    _pathChunkClusters.erase( chunk );
+  }
+
+  void ParticleManager::clearPathChunks( )
+  {
+    _pathChunkClusters.clear( );
   }
 
-  void ParticleManager::setDynamic(
+  void ParticleManager::addDynamic(
     const std::vector< DynamicPathParticle >& particles )
   {
-    _dynamicCluster->setParticles( particles );
+    auto cluster = std::make_shared< plab::Cluster< DynamicPathParticle >>( );
+    cluster->setModel( _dynamicModel );
+    cluster->setRenderer( isAccumulativeMode( ) ?
+                          _dynamicAccRenderer : _dynamicRenderer );
+    cluster->setParticles( particles );
+
+    DynamicChunk< DynamicPathParticle > chunk = { cluster ,
+      std::numeric_limits< float >::max( ) ,
+      -std::numeric_limits< float >::max( ) };
+    for ( const auto& particle: particles )
+    {
+      chunk.start = std::min( chunk.start , particle.timestamp );
+      chunk.end = std::max( chunk.end , particle.timestamp );
+    }
+
+    _dynamicClusters.push_back( chunk );
+  }
+
+  void ParticleManager::addDynamic(
+    const std::vector< DynamicPathSegment >& segments )
+  {
+    auto cluster = std::make_shared< plab::Cluster< DynamicPathSegment >>( );
+    cluster->setModel( _dynamicModel );
+    cluster->setRenderer( isAccumulativeMode( ) ?
+                          _dynamicSegmentAccRenderer : _dynamicSegmentRenderer );
+    cluster->setParticles( segments );
+
+    DynamicChunk< DynamicPathSegment > chunk = { cluster ,
+      std::numeric_limits< float >::max( ) ,
+      -std::numeric_limits< float >::max( ) };
+    for ( const auto& segment: segments )
+    {
+      chunk.start = std::min( chunk.start , segment.times.x );
+      chunk.end = std::max( chunk.end , segment.times.y );
+    }
+
+    _dynamicSegmentClusters.push_back( chunk );
   }
 
   void ParticleManager::clearSynapses( )
@@ -307,12 +452,17 @@ namespace syncopa
 
   void ParticleManager::clearPaths( )
   {
+    _pathParticles.clear( );
+    _neuronPaths.clear( );
+    _compactPaths = false;
+
     _pathCluster->allocateBuffer( 0 );
   }
 
   void ParticleManager::clearDynamic( )
   {
-    _dynamicCluster->allocateBuffer( 0 );
+    _dynamicClusters.clear( );
+    _dynamicSegmentClusters.clear( );
   }
 
   void ParticleManager::draw( bool drawPaths , bool drawDynamic ) const
@@ -325,9 +475,27 @@ namespace syncopa
     {
       _pathCluster->render( );
     }
-    if ( drawDynamic && _dynamicCluster != nullptr )
+    if ( drawPaths )
+    {
+      for ( const auto& chunk: _pathChunkClusters )
+        chunk.second->render( );
+    }
+    if ( drawDynamic )
     {
-      _dynamicCluster->render( );
+      // Elements are lit from their time to a pulse later.
+      const float timestamp = _dynamicModel->getTimestamp( );
+      const float first = timestamp - _dynamicModel->getPulseDuration( );
+
+      for ( const auto& chunk: _dynamicClusters )
+      {
+        if ( chunk.start < timestamp && first <= chunk.end )
+          chunk.cluster->render( );
+      }
+      for ( const auto& chunk: _dynamicSegmentClusters )
+      {
+        if ( chunk.start < timestamp && first <= chunk.end )
+          chunk.cluster->render( );
+      }
     }
   }
 
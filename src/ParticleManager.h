@@ -9,12 +9,15 @@
 #include "particlelab/StaticModel.h"
 #include "particlelab/StaticGradientModel.h"
 #include "particlelab/DynamicPathParticle.h"
+#include "particlelab/DynamicPathSegment.h"
 #include "particlelab/DynamicModel.h"
 
 #include <plab/core/Cluster.h>
 #include <reto/ShaderProgram.h>
 #include <nlgeometry/AxisAlignedBoundingBox.h>
 
+#include <map>
+
 namespace syncopa
 {
 
@@ -27,18 +30,22 @@ namespace syncopa
     reto::ShaderProgram _staticProgram;
     reto::ShaderProgram _staticGradientProgram;
     reto::ShaderProgram _dynamicProgram;
+    reto::ShaderProgram _dynamicSegmentProgram;
 
     reto::ShaderProgram _staticAccProgram;
     reto::ShaderProgram _staticAccGradientProgram;
     reto::ShaderProgram _dynamicAccProgram;
+    reto::ShaderProgram _dynamicSegmentAccProgram;
 
     std::shared_ptr< plab::Renderer > _staticRenderer;
     std::shared_ptr< plab::Renderer > _staticGradientRenderer;
     std::shared_ptr< plab::Renderer > _dynamicRenderer;
+    std::shared_ptr< plab::Renderer > _dynamicSegmentRenderer;
 
     std::shared_ptr< plab::Renderer > _staticAccRenderer;
     std::shared_ptr< plab::Renderer > _staticAccGradientRenderer;
     std::shared_ptr< plab::Renderer > _dynamicAccRenderer;
+    std::shared_ptr< plab::Renderer > _dynamicSegmentAccRenderer;
 
     // SYNAPSES
     std::shared_ptr< plab::Cluster< SynapseParticle >> _synapseCluster;
@@ -51,8 +58,39 @@ namespace syncopa
     std::shared_ptr< StaticModel > _pathModel;
     nlgeometry::AxisAlignedBoundingBox _pathBB;
 
+    //! Particles of a neuron inside _pathParticles.
+    struct NeuronPathRange
+    {
+      size_t offset;
+      size_t size;
+      glm::vec3 min;
+      glm::vec3 max;
+    };
+
+    std::vector< SynapseParticle > _pathParticles;
+    std::map< unsigned int , NeuronPathRange > _neuronPaths;
+    bool _compactPaths;
+
+    /*! Resident chunks of a path chunk file, by chunk index. One cluster
+     * per chunk, so paging only uploads the new ones. */
+    std::map< unsigned int ,
+      std::shared_ptr< plab::Cluster< SynapseParticle >>> _pathChunkClusters;
+
     // DYNAMIC
-    std::shared_ptr< plab::Cluster< DynamicPathParticle>> _dynamicCluster;
+    //! Uploaded chunk and the times its first and last elements are lit.
+    template< typename T >
+    struct DynamicChunk
+    {
+      std::shared_ptr< plab::Cluster< T >> cluster;
+      float start;
+      float end;
+    };
+
+    /*! One cluster per uploaded chunk, so chunks are never uploaded again.
+     * Chunks cover consecutive time windows and only those lit at the
+     * current timestamp are drawn. */
+    std::vector< DynamicChunk< DynamicPathParticle >> _dynamicClusters;
+    std::vector< DynamicChunk< DynamicPathSegment >> _dynamicSegmentClusters;
     std::shared_ptr< DynamicModel > _dynamicModel;
 
     // OTHER
@@ -92,10 +130,29 @@ namespace syncopa
     void setMappedSynapses( const tsynapseVec& synapses ,
                             const tFloatVec& lifeValues );
 
-    void setPaths(
-      const std::vector< vec3 >& pre , const std::vector< vec3 >& post );
+    //! Replaces the path particles of a neuron. Uploaded by updatePaths.
+    void setNeuronPaths( unsigned int gid ,
+                         const std::vector< vec3 >& pre ,
+                         const std::vector< vec3 >& post );
+
+    void removeNeuronPaths( unsigned int gid );
+
+    //! Uploads the path particles after setting or removing neurons.
+    void updatePaths( );
+
+    //! Uploads a chunk of a path chunk file, in its own buffer.
+    void setPathChunk( unsigned int chunk , const std::vector< vec3 >& positions ,
+                       bool postsynaptic );
+
+    void removePathChunk( unsigned int chunk );
+
+    void clearPathChunks( );
+
+    //! Appends a chunk of dynamic particles, in its own buffer.
+    void addDynamic( const std::vector< DynamicPathParticle >& particles );
 
-    void setDynamic( const std::vector< DynamicPathParticle >& particles );
+    //! Appends a chunk of dynamic segments, pulses placed by the shader.
+    void addDynamic( const std::vector< DynamicPathSegment >& segments );
 
     void clearSynapses( );
 
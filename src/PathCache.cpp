@@ -0,0 +1,326 @@
+/*
+ * @file  PathCache.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+
+#include "PathCache.h"
+
+#include <cstring>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace syncopa
+{
+  //! Header of a cached block, followed by the pre and post positions.
+  struct PathCacheHeader
+  {
+    char magic[ 4 ];
+    uint32_t version;
+    uint64_t preCount;
+    uint64_t postCount;
+  };
+
+  static const char pathCacheMagic[ 4 ] = { 'S' , 'Y' , 'P' , 'C' };
+  static const uint32_t pathCacheVersion = 1;
+
+  //! Blocks waiting to be written before store blocks.
+  static const size_t pathCacheMaxPending = 64;
+
+  static_assert( sizeof( vec3 ) == sizeof( float ) * 3 ,
+                 "Cached positions are stored as packed floats" );
+
+  PathCache::PathCache( void )
+    : _maxSize( 4ull << 30 )
+    , _directorySize( 0 )
+    , _stopWriting( false )
+  { }
+
+  PathCache::~PathCache( void )
+  {
+    _stopWriter( );
+  }
+
+  void PathCache::open( const std::string& datasetID ,
+                        const std::vector< std::string >& sources )
+  {
+    _stopWriter( );
+
+    _datasetID.clear( );
+    _directory.clear( );
+
+    if ( datasetID.empty( ))
+      return;
+
+    // Regenerated files at the same paths change the identifier.
+    QCryptographicHash hash( QCryptographicHash::Sha1 );
+    hash.addData( datasetID.data( ) , static_cast< int >( datasetID.size( )));
+    for ( const auto& source: sources )
+      _addSource( hash , QString::fromStdString( source ));
+    _datasetID = hash.result( ).toHex( ).toStdString( );
+
+    const auto root =
+      QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+    if ( root.isEmpty( ))
+      return;
+
+    QDir directory( root + "/paths" );
+    if ( !directory.mkpath( "." ))
+    {
+      std::cerr << "Couldn't create path cache directory "
+                << directory.path( ).toStdString( ) << std::endl;
+      return;
+    }
+
+    _directory = directory.path( );
+
+    _evict( _maxSize );
+
+    _writer = std::thread( &PathCache::_writeBlocks , this );
+  }
+
+  bool PathCache::enabled( void ) const
+  {
+    return !_directory.isEmpty( );
+  }
+
+  void PathCache::maxSize( uint64_t bytes )
+  {
+    _maxSize = bytes;
+  }
+
+  uint64_t PathCache::maxSize( void ) const
+  {
+    return _maxSize;
+  }
+
+  void PathCache::_addSource( QCryptographicHash& hash , const QString& source )
+  {
+    const QFileInfo info( source );
+
+    auto add = [ &hash ]( const QFileInfo& file )
+    {
+      const qint64 size = file.size( );
+      const qint64 modified = file.lastModified( ).toMSecsSinceEpoch( );
+      hash.addData( file.absoluteFilePath( ).toUtf8( ));
+      hash.addData( reinterpret_cast< const char* >( &size ) , sizeof( size ));
+      hash.addData( reinterpret_cast< const char* >( &modified ) ,
+                    sizeof( modified ));
+    };
+
+    if ( !info.isDir( ))
+    {
+      add( info );
+      return;
+    }
+
+    for ( const auto& file:
+            QDir( source ).entryInfoList( QDir::Files , QDir::Name ))
+      add( file );
+  }
+
+  void PathCache::_evict( uint64_t size )
+  {
+    QDir directory( _directory );
+
+    // Oldest blocks last, so they are the first ones left out.
+    const auto files = directory.entryInfoList(
+      QStringList( ) << "*.bin" , QDir::Files , QDir::Time );
+
+    _directorySize = 0;
+    unsigned int removed = 0;
+    for ( const auto& file: files )
+    {
+      const auto fileSize = static_cast< uint64_t >( file.size( ));
+      if ( _directorySize + fileSize > size &&
+           directory.remove( file.fileName( )))
+      {
+        ++removed;
+        continue;
+      }
+
+      _directorySize += fileSize;
+    }
+
+    if ( removed > 0 )
+    {
+      std::cout << "Removed " << removed << " old path cache blocks."
+                << std::endl;
+    }
+  }
+
+  QString PathCache::key( unsigned int gid ,
+                          const tsynapseVec& preSynapses ,
+                          const tsynapseVec& postSynapses ,
+                          const std::vector< float >& parameters ) const
+  {
+    QCryptographicHash hash( QCryptographicHash::Sha1 );
+
+    auto add = [ &hash ]( const void* data , size_t size )
+    {
+      hash.addData( static_cast< const char* >( data ) ,
+                    static_cast< int >( size ));
+    };
+
+    add( &pathCacheVersion , sizeof( pathCacheVersion ));
+    add( _datasetID.data( ) , _datasetID.size( ));
+    add( &gid , sizeof( gid ));
+
+    // Synapse gids identify the connected partners and the sections used.
+    for ( const auto synapses: { &preSynapses , &postSynapses })
+    {
+      const uint64_t count = synapses->size( );
+      add( &count , sizeof( count ));
+      for ( const auto synapse: *synapses )
+      {
+        const auto synapseGid = synapse->gid( );
+        add( &synapseGid , sizeof( synapseGid ));
+      }
+    }
+
+    if ( !parameters.empty( ))
+      add( parameters.data( ) , parameters.size( ) * sizeof( float ));
+
+    return QString( hash.result( ).toHex( ));
+  }
+
+  bool PathCache::load( const QString& key ,
+                        std::vector< vec3 >& preOut ,
+                        std::vector< vec3 >& postOut ) const
+  {
+    if ( !enabled( ))
+      return false;
+
+    QFile file( _filePath( key ));
+    if ( !file.open( QIODevice::ReadOnly ))
+      return false;
+
+    PathCacheHeader header;
+    if ( file.read( reinterpret_cast< char* >( &header ) , sizeof( header )) !=
+         static_cast< qint64 >( sizeof( header )))
+      return false;
+
+    const bool valid =
+      std::memcmp( header.magic , pathCacheMagic , sizeof( pathCacheMagic )) == 0 &&
+      header.version == pathCacheVersion &&
+      static_cast< uint64_t >( file.size( )) == sizeof( header ) +
+        ( header.preCount + header.postCount ) * sizeof( vec3 );
+    if ( !valid )
+      return false;
+
+    // Positions are read straight into the particle vectors.
+    preOut.resize( header.preCount );
+    postOut.resize( header.postCount );
+    for ( const auto positions: { &preOut , &postOut })
+    {
+      const auto size = static_cast< qint64 >( positions->size( ) * sizeof( vec3 ));
+      if ( size > 0 &&
+           file.read( reinterpret_cast< char* >( positions->data( )) , size ) != size )
+        return false;
+    }
+
+    return true;
+  }
+
+  void PathCache::store( const QString& key ,
+                         const std::vector< vec3 >& preOut ,
+                         const std::vector< vec3 >& postOut )
+  {
+    if ( !enabled( ))
+      return;
+
+    std::unique_lock< std::mutex > lock( _writesMutex );
+
+    // Sampling faster than the disk waits here, keeping memory bounded.
+    _writesCondition.wait( lock , [ this ]( )
+    { return _pending.size( ) < pathCacheMaxPending; } );
+
+    _pending.push_back( PendingBlock{ _filePath( key ) , preOut , postOut } );
+    _writesCondition.notify_all( );
+  }
+
+  QString PathCache::_filePath( const QString& key ) const
+  {
+    return _directory + "/" + key + ".bin";
+  }
+
+  void PathCache::_writeBlocks( void )
+  {
+    std::unique_lock< std::mutex > lock( _writesMutex );
+
+    while ( true )
+    {
+      _writesCondition.wait( lock , [ this ]( )
+      { return _stopWriting || !_pending.empty( ); } );
+
+      if ( _pending.empty( ))
+        return;
+
+      const auto block = std::move( _pending.front( ));
+      _pending.pop_front( );
+      _writesCondition.notify_all( );
+
+      lock.unlock( );
+      _write( block );
+      lock.lock( );
+    }
+  }
+
+  void PathCache::_write( const PendingBlock& block )
+  {
+    PathCacheHeader header;
+    std::memcpy( header.magic , pathCacheMagic , sizeof( pathCacheMagic ));
+    header.version = pathCacheVersion;
+    header.preCount = block.pre.size( );
+    header.postCount = block.post.size( );
+
+    // QSaveFile writes a temporary file and renames it on commit, so
+    // readers never see partial blocks.
+    QSaveFile file( block.path );
+    bool written = file.open( QIODevice::WriteOnly ) &&
+      file.write( reinterpret_cast< const char* >( &header ) , sizeof( header )) ==
+        static_cast< qint64 >( sizeof( header ));
+    for ( const auto positions: { &block.pre , &block.post })
+    {
+      const auto size = static_cast< qint64 >( positions->size( ) * sizeof( vec3 ));
+      written = written && ( size == 0 || file.write(
+        reinterpret_cast< const char* >( positions->data( )) , size ) == size );
+    }
+
+    if ( !written || !file.commit( ))
+    {
+      std::cerr << "Couldn't write path cache block "
+                << block.path.toStdString( ) << std::endl;
+      return;
+    }
+
+    // Trimmed below the limit, so that the directory is not listed again
+    // on every write.
+    _directorySize += sizeof( header ) +
+      ( header.preCount + header.postCount ) * sizeof( vec3 );
+    if ( _directorySize > _maxSize )
+      _evict( _maxSize / 4 * 3 );
+  }
+
+  void PathCache::_stopWriter( void )
+  {
+    {
+      std::lock_guard< std::mutex > lock( _writesMutex );
+      _stopWriting = true;
+    }
+    _writesCondition.notify_all( );
+
+    if ( _writer.joinable( ))
+      _writer.join( );
+
+    _stopWriting = false;
+  }
+}
@@ -0,0 +1,112 @@
+/*
+ * @file  PathCache.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#ifndef SRC_PATHCACHE_H_
+#define SRC_PATHCACHE_H_
+
+#include "types.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <QCryptographicHash>
+#include <QString>
+
+namespace syncopa
+{
+  /*! Persistent cache of the path particles of single neurons. Each block
+   * is stored in its own file, named after the hash of everything the
+   * particles depend on, including the size and modification time of the
+   * dataset files. Blocks are written in the background by a single
+   * thread, and store blocks while too many of them are pending. The
+   * oldest blocks are removed whenever the directory goes above its size
+   * limit. */
+  class PathCache
+  {
+  public:
+
+    PathCache( void );
+
+    //! Waits for the pending writes.
+    ~PathCache( void );
+
+    /*! Uses the cache of the dataset identified by the given string, such
+     * as its file path and target, and by the state of the given source
+     * files. Directories add the state of the files they hold. An empty
+     * identifier disables it. */
+    void open( const std::string& datasetID ,
+               const std::vector< std::string >& sources =
+                 std::vector< std::string >( ));
+
+    bool enabled( void ) const;
+
+    //! Size limit of the cache directory in bytes.
+    void maxSize( uint64_t bytes );
+    uint64_t maxSize( void ) const;
+
+    /*! Key of the paths of neuron gid, given its synapses and the
+     * parameters used to sample them. Thread safe. */
+    QString key( unsigned int gid ,
+                 const tsynapseVec& preSynapses ,
+                 const tsynapseVec& postSynapses ,
+                 const std::vector< float >& parameters ) const;
+
+    //! Fills the particles of the given key. Returns false on a miss. Thread safe.
+    bool load( const QString& key ,
+               std::vector< vec3 >& preOut ,
+               std::vector< vec3 >& postOut ) const;
+
+    //! Writes the particles in the background, replacing the file on success.
+    void store( const QString& key ,
+                const std::vector< vec3 >& preOut ,
+                const std::vector< vec3 >& postOut );
+
+  protected:
+
+    //! Block waiting for the writer thread.
+    struct PendingBlock
+    {
+      QString path;
+      std::vector< vec3 > pre;
+      std::vector< vec3 > post;
+    };
+
+    QString _filePath( const QString& key ) const;
+
+    //! Adds the path, size and modification time of source to the hash.
+    static void _addSource( QCryptographicHash& hash , const QString& source );
+
+    /*! Removes the oldest blocks until the directory holds at most size
+     * bytes, updating the known directory size. */
+    void _evict( uint64_t size );
+
+    //! Writer thread loop, until stopped and no block is pending.
+    void _writeBlocks( void );
+
+    void _write( const PendingBlock& block );
+
+    //! Waits for the pending writes and the writer thread.
+    void _stopWriter( void );
+
+    std::string _datasetID;
+    QString _directory;
+    uint64_t _maxSize;
+    //! Bytes in the directory, only used by the writer once open.
+    uint64_t _directorySize;
+
+    std::thread _writer;
+    std::deque< PendingBlock > _pending;
+    bool _stopWriting;
+    std::mutex _writesMutex;
+    std::condition_variable _writesCondition;
+  };
+}
+
+#endif /* SRC_PATHCACHE_H_ */
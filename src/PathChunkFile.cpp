@@ -0,0 +1,291 @@
+/*
+ * @file  PathChunkFile.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+
+#include "PathChunkFile.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace syncopa
+{
+  struct PathChunkHeader
+  {
+    char magic[ 4 ];
+    uint32_t version;
+    uint64_t chunkCount;
+    uint64_t indexOffset;
+  };
+
+  static const char pathChunkMagic[ 4 ] = { 'S' , 'Y' , 'P' , 'K' };
+  static const uint32_t pathChunkVersion = 1;
+
+  static uint64_t cellKey( const vec3& position , float cellSize ,
+                           TNeuronConnection type )
+  {
+    // 21 bits per axis, enough for a column with micrometer sized cells.
+    auto axis = [ & ]( float value )
+    {
+      const auto cell = static_cast< int64_t >(
+        std::floor( value / cellSize )) + ( 1 << 20 );
+      return static_cast< uint64_t >(
+        std::max< int64_t >( 0 , std::min< int64_t >( cell , ( 1 << 21 ) - 1 )));
+    };
+
+    return ( axis( position.x( )) << 43 ) | ( axis( position.y( )) << 22 ) |
+           ( axis( position.z( )) << 1 ) |
+           ( type == POSTSYNAPTIC ? 1u : 0u );
+  }
+
+  PathChunkWriter::PathChunkWriter( void )
+    : _cellSize( 1.0f )
+    , _bufferedParticles( 0 )
+    , _buffered( 0 )
+    , _particles( 0 )
+  { }
+
+  PathChunkWriter::~PathChunkWriter( void )
+  {
+    if ( _file.is_open( ))
+      close( );
+  }
+
+  bool PathChunkWriter::open( const std::string& filePath , float cellSize ,
+                              size_t bufferedParticles )
+  {
+    _file.open( filePath , std::ofstream::out | std::ofstream::binary |
+                           std::ofstream::trunc );
+    if ( !_file.good( ))
+    {
+      std::cerr << "Couldn't open path chunk file " << filePath << std::endl;
+      return false;
+    }
+
+    _cellSize = std::max( cellSize , std::numeric_limits< float >::epsilon( ));
+    _bufferedParticles = bufferedParticles;
+    _buffered = 0;
+    _particles = 0;
+    _cells.clear( );
+    _chunks.clear( );
+
+    // Rewritten on close, once the index offset is known.
+    PathChunkHeader header = PathChunkHeader( );
+    _file.write( reinterpret_cast< const char* >( &header ) , sizeof( header ));
+
+    return true;
+  }
+
+  void PathChunkWriter::add( TNeuronConnection type ,
+                             const std::vector< vec3 >& particles )
+  {
+    for ( const auto& particle: particles )
+      _cells[ cellKey( particle , _cellSize , type ) ].push_back( particle );
+
+    _buffered += particles.size( );
+    _particles += particles.size( );
+
+    if ( _buffered >= _bufferedParticles )
+      flush( );
+  }
+
+  void PathChunkWriter::flush( void )
+  {
+    for ( const auto& cell: _cells )
+    {
+      const auto& particles = cell.second;
+
+      PathChunk chunk;
+      chunk.offset = static_cast< uint64_t >( _file.tellp( ));
+      chunk.count = static_cast< uint32_t >( particles.size( ));
+      chunk.type = static_cast< uint32_t >(
+        ( cell.first & 1u ) ? POSTSYNAPTIC : PRESYNAPTIC );
+
+      vec3 minimum = vec3::Constant( std::numeric_limits< float >::max( ));
+      vec3 maximum = vec3::Constant( -std::numeric_limits< float >::max( ));
+      for ( const auto& particle: particles )
+      {
+        minimum = minimum.cwiseMin( particle );
+        maximum = maximum.cwiseMax( particle );
+        _file.write( reinterpret_cast< const char* >( particle.data( )) ,
+                     sizeof( float ) * 3 );
+      }
+
+      std::memcpy( chunk.min , minimum.data( ) , sizeof( chunk.min ));
+      std::memcpy( chunk.max , maximum.data( ) , sizeof( chunk.max ));
+
+      _chunks.push_back( chunk );
+    }
+
+    _cells.clear( );
+    _buffered = 0;
+  }
+
+  bool PathChunkWriter::close( void )
+  {
+    if ( !_file.is_open( ))
+      return false;
+
+    flush( );
+
+    PathChunkHeader header;
+    std::memcpy( header.magic , pathChunkMagic , sizeof( pathChunkMagic ));
+    header.version = pathChunkVersion;
+    header.chunkCount = _chunks.size( );
+    header.indexOffset = static_cast< uint64_t >( _file.tellp( ));
+
+    if ( !_chunks.empty( ))
+      _file.write( reinterpret_cast< const char* >( _chunks.data( )) ,
+                   _chunks.size( ) * sizeof( PathChunk ));
+
+    _file.seekp( 0 );
+    _file.write( reinterpret_cast< const char* >( &header ) , sizeof( header ));
+
+    const bool good = _file.good( );
+    _file.close( );
+    _chunks.clear( );
+
+    return good;
+  }
+
+  size_t PathChunkWriter::particles( void ) const
+  {
+    return _particles;
+  }
+
+  PathChunkReader::PathChunkReader( void )
+    : _data( nullptr )
+    , _size( 0 )
+  { }
+
+  PathChunkReader::~PathChunkReader( void )
+  {
+    close( );
+  }
+
+  bool PathChunkReader::open( const std::string& filePath )
+  {
+    close( );
+
+    _file.setFileName( QString::fromStdString( filePath ));
+    if ( !_file.open( QIODevice::ReadOnly ))
+    {
+      std::cerr << "Couldn't open path chunk file " << filePath << std::endl;
+      return false;
+    }
+
+    _size = static_cast< uint64_t >( _file.size( ));
+    _data = _size > sizeof( PathChunkHeader ) ?
+            _file.map( 0 , _file.size( )) : nullptr;
+
+    PathChunkHeader header;
+    if ( _data )
+      std::memcpy( &header , _data , sizeof( header ));
+
+    if ( !_data ||
+         std::memcmp( header.magic , pathChunkMagic ,
+                      sizeof( pathChunkMagic )) != 0 ||
+         header.version != pathChunkVersion ||
+         header.indexOffset + header.chunkCount * sizeof( PathChunk ) > _size )
+    {
+      std::cerr << "Invalid path chunk file " << filePath << std::endl;
+      close( );
+      return false;
+    }
+
+    _chunks.resize( header.chunkCount );
+    if ( !_chunks.empty( ))
+      std::memcpy( _chunks.data( ) , _data + header.indexOffset ,
+                   _chunks.size( ) * sizeof( PathChunk ));
+
+    return true;
+  }
+
+  void PathChunkReader::close( void )
+  {
+    if ( _data )
+      _file.unmap( const_cast< uchar* >( _data ));
+
+    if ( _file.isOpen( ))
+      _file.close( );
+
+    _data = nullptr;
+    _size = 0;
+    _chunks.clear( );
+  }
+
+  bool PathChunkReader::isOpen( void ) const
+  {
+    return _data != nullptr;
+  }
+
+  const std::vector< PathChunk >& PathChunkReader::chunks( void ) const
+  {
+    return _chunks;
+  }
+
+  std::vector< unsigned int >
+  PathChunkReader::visibleChunks( const mat4& viewProjection ,
+                                  const vec3& position ) const
+  {
+    // Frustum planes from the rows of the matrix, pointing inwards.
+    Eigen::Matrix< float , 6 , 4 > planes;
+    for ( int i = 0; i < 3; ++i )
+    {
+      planes.row( i * 2 ) = viewProjection.row( 3 ) + viewProjection.row( i );
+      planes.row( i * 2 + 1 ) = viewProjection.row( 3 ) - viewProjection.row( i );
+    }
+
+    std::vector< std::pair< float , unsigned int >> visible;
+    for ( unsigned int i = 0; i < _chunks.size( ); ++i )
+    {
+      const Eigen::Map< const vec3 > minimum( _chunks[ i ].min );
+      const Eigen::Map< const vec3 > maximum( _chunks[ i ].max );
+
+      bool inside = true;
+      for ( int p = 0; p < 6 && inside; ++p )
+      {
+        // Box corner farthest along the plane normal.
+        const vec3 normal = planes.block< 1 , 3 >( p , 0 ).transpose( );
+        const vec3 corner = ( normal.array( ) >= 0.0f ).select( maximum , minimum );
+        inside = normal.dot( corner ) + planes( p , 3 ) >= 0.0f;
+      }
+
+      if ( inside )
+        visible.emplace_back(
+          ( 0.5f * ( minimum + maximum ) - position ).squaredNorm( ) , i );
+    }
+
+    std::sort( visible.begin( ) , visible.end( ));
+
+    std::vector< unsigned int > result;
+    result.reserve( visible.size( ));
+    for ( const auto& item: visible )
+      result.push_back( item.second );
+
+    return result;
+  }
+
+  void PathChunkReader::read( unsigned int chunk ,
+                              std::vector< vec3 >& particles ) const
+  {
+    particles.clear( );
+    if ( !_data || chunk >= _chunks.size( ))
+      return;
+
+    const auto& info = _chunks[ chunk ];
+    if ( info.offset + uint64_t( info.count ) * sizeof( float ) * 3 > _size )
+      return;
+
+    particles.resize( info.count );
+    for ( uint32_t i = 0; i < info.count; ++i )
+      std::memcpy( particles[ i ].data( ) ,
+                   _data + info.offset + i * sizeof( float ) * 3 ,
+                   sizeof( float ) * 3 );
+  }
+}
@@ -0,0 +1,105 @@
+/*
+ * @file  PathChunkFile.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#ifndef SRC_PATHCHUNKFILE_H_
+#define SRC_PATHCHUNKFILE_H_
+
+#include "types.h"
+
+#include <fstream>
+
+#include <QFile>
+
+namespace syncopa
+{
+  /*! Particles of one type inside a cell of the spatial grid, as stored in
+   * the index at the end of a path chunk file. */
+  struct PathChunk
+  {
+    float min[ 3 ];
+    float max[ 3 ];
+    uint64_t offset;
+    uint32_t count;
+    uint32_t type;
+  };
+
+  /*! Writes path particles into a chunked binary file. Particles are binned
+   * in a uniform grid and buffered up to a particle budget. When the budget
+   * is reached, each non empty cell is written as a chunk, so memory stays
+   * bounded however many particles are added. The chunk index is written
+   * on close. */
+  class PathChunkWriter
+  {
+  public:
+
+    PathChunkWriter( void );
+
+    ~PathChunkWriter( void );
+
+    bool open( const std::string& filePath , float cellSize ,
+               size_t bufferedParticles );
+
+    void add( TNeuronConnection type , const std::vector< vec3 >& particles );
+
+    //! Writes the buffered particles as chunks.
+    void flush( void );
+
+    bool close( void );
+
+    size_t particles( void ) const;
+
+  protected:
+
+    std::ofstream _file;
+
+    float _cellSize;
+    size_t _bufferedParticles;
+    size_t _buffered;
+    size_t _particles;
+
+    //! Buffered positions by cell and type.
+    std::unordered_map< uint64_t , std::vector< vec3 >> _cells;
+
+    std::vector< PathChunk > _chunks;
+  };
+
+  /*! Maps a path chunk file and returns the chunks inside a view frustum. */
+  class PathChunkReader
+  {
+  public:
+
+    PathChunkReader( void );
+
+    ~PathChunkReader( void );
+
+    bool open( const std::string& filePath );
+
+    void close( void );
+
+    bool isOpen( void ) const;
+
+    const std::vector< PathChunk >& chunks( void ) const;
+
+    /*! Indices of the chunks intersecting the frustum of the given matrix,
+     * sorted by distance to the given position. */
+    std::vector< unsigned int > visibleChunks( const mat4& viewProjection ,
+                                               const vec3& position ) const;
+
+    void read( unsigned int chunk , std::vector< vec3 >& particles ) const;
+
+  protected:
+
+    QFile _file;
+    const uchar* _data;
+    uint64_t _size;
+
+    std::vector< PathChunk > _chunks;
+  };
+}
+
+#endif /* SRC_PATHCHUNKFILE_H_ */
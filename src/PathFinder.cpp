@@ -12,12 +12,20 @@
 #include <brain/brain.h>
 #include <QDebug>
 
+#include <map>
+
 namespace syncopa
 {
 
   PathFinder::PathFinder( void )
     : _dataset( nullptr )
     , _synapseFixInfo( nullptr )
+    , _synapseIndex( nullptr )
+    , _cache( nullptr )
+    , _pointSize( 0.0f )
+    , _simplification( 0.0f )
+    , _adaptiveSampling( false )
+    , _sampledAdaptive( false )
     , _maxDepth( 0 )
   { }
 
@@ -27,82 +35,381 @@ namespace syncopa
   }
 
   void PathFinder::dataset( nsol::DataSet* dataset_ ,
-                            const TSynapseInfo* synapseInfo )
+                            const TSynapseInfo* synapseInfo ,
+                            const SynapseIndex* synapseIndex )
   {
+    clear( );
+
     _dataset = dataset_;
     _synapseFixInfo = synapseInfo;
+    _synapseIndex = synapseIndex;
+
+    _geometry.build( _dataset , _simplification );
   }
 
   void PathFinder::configure(
-    const std::vector< nsol::SynapsePtr >& synapses ,
     const std::unordered_set< unsigned int >& preNeuronsWithAllPaths ,
     const std::unordered_set< unsigned int >& postNeuronsWithAllPaths ,
     const std::unordered_set< unsigned int >& preNeuronsWithConnectedPaths ,
     const std::unordered_set< unsigned int >& postNeuronsWithConnectedPaths ,
     float pointSize ,
-    std::vector< vec3 >& preOut ,
-    std::vector< vec3 >& postOut )
+    std::vector< unsigned int >& removedNeurons ,
+    std::vector< unsigned int >& updatedNeurons )
   {
-    clear( );
+    // Sampled points depend on the point size, the sampling mode and the
+    // section geometry, nothing can be kept.
+    const bool simplificationChanged =
+      _simplification != _geometry.tolerance( );
+    if ( pointSize != _pointSize || _adaptiveSampling != _sampledAdaptive ||
+         simplificationChanged )
+    {
+      for ( const auto& task: _neuronTasks )
+        removedNeurons.push_back( task.first );
+
+      clear( );
+      _pointSize = pointSize;
+      _sampledAdaptive = _adaptiveSampling;
+
+      if ( simplificationChanged )
+        _geometry.build( _dataset , _simplification );
+    }
 
-    tsynapseVec outUsedSynapses;
     tsynapseVec outUsedPreSynapses;
     tsynapseVec outUsedPostSynapses;
 
     _calculateSynapses(
-      synapses ,
       preNeuronsWithAllPaths ,
       postNeuronsWithAllPaths ,
       preNeuronsWithConnectedPaths ,
       postNeuronsWithConnectedPaths ,
-      outUsedSynapses ,
       outUsedPreSynapses ,
       outUsedPostSynapses
     );
 
-    _populateTrees( outUsedPreSynapses , outUsedPostSynapses );
+    auto tasks = _createTasks( outUsedPreSynapses , outUsedPostSynapses );
 
-    _processSections( outUsedPreSynapses , outUsedPostSynapses );
-    _processEndSections( outUsedPreSynapses , outUsedPostSynapses );
+    // Neurons keeping exactly the same synapses keep their paths. After
+    // this loop, tasks only holds new or changed neurons.
+    for ( auto it = _neuronTasks.begin( ); it != _neuronTasks.end( ); )
+    {
+      auto current = tasks.find( it->first );
+      if ( current != tasks.end( ) &&
+           current->second.preSynapses == it->second.preSynapses &&
+           current->second.postSynapses == it->second.postSynapses )
+      {
+        tasks.erase( current );
+        ++it;
+        continue;
+      }
 
+      removedNeurons.push_back( it->first );
+      _removeTask( it->second );
+      it = _neuronTasks.erase( it );
+    }
 
-    std::unordered_set< nsol::NeuronMorphologySectionPtr > insertedSections;
-    for ( const auto& synapse: outUsedPreSynapses )
+    // Containers are created here, so that the parallel stages never
+    // insert in the shared maps.
+    std::vector< NeuronPathTask* > pending;
+    pending.reserve( tasks.size( ));
+    for ( auto& item: tasks )
     {
-      _createPath( insertedSections , preOut , synapse , PRESYNAPTIC ,
-                   pointSize );
+      auto& task = _neuronTasks.insert(
+        std::make_pair( item.first , std::move( item.second ))).first->second;
+
+      if ( !task.preSynapses.empty( ))
+        task.treePre = &_treePre[ task.gid ];
+      if ( !task.postSynapses.empty( ))
+        task.treePost = &_treePost[ task.gid ];
+      task.sections = &_sectionTables[ task.gid ];
+
+      pending.push_back( &task );
+      updatedNeurons.push_back( task.gid );
     }
 
-    for ( const auto& synapse: outUsedPostSynapses )
+    // Neurons found in the path cache skip every stage. Their trees are
+    // only built if dynamic paths are requested.
+    std::vector< QString > pendingKeys( pending.size( ));
+    std::vector< char > cached( pending.size( ) , false );
+    if ( _cache && _cache->enabled( ))
     {
-      _createPath( insertedSections , postOut , synapse , POSTSYNAPTIC ,
-                   pointSize );
+#pragma omp parallel for schedule(dynamic)
+      for ( unsigned int i = 0; i < pending.size( ); ++i )
+      {
+        pendingKeys[ i ] = _cacheKey( *pending[ i ] );
+        cached[ i ] = _cache->load( pendingKeys[ i ] , pending[ i ]->preOut ,
+                                    pending[ i ]->postOut );
+      }
+    }
+
+    std::vector< NeuronPathTask* > sampled;
+    std::vector< QString > cacheKeys;
+    sampled.reserve( pending.size( ));
+    for ( unsigned int i = 0; i < pending.size( ); ++i )
+    {
+      if ( cached[ i ] )
+        continue;
+
+      sampled.push_back( pending[ i ] );
+      cacheKeys.push_back( pendingKeys[ i ] );
+    }
+
+    _processTasks( sampled , true );
+
+    if ( _cache && _cache->enabled( ))
+    {
+      for ( unsigned int i = 0; i < sampled.size( ); ++i )
+        _cache->store( cacheKeys[ i ] , sampled[ i ]->preOut ,
+                       sampled[ i ]->postOut );
     }
   }
 
-  void PathFinder::_populateTrees( const tsynapseVec& preSynapses ,
-                                   const tsynapseVec& postSynapses )
+  void PathFinder::prepareDynamicPaths( void )
   {
+    std::vector< NeuronPathTask* > pending;
+    for ( auto& task: _neuronTasks )
+    {
+      if ( !task.second.processed )
+        pending.push_back( &task.second );
+    }
 
-    for ( auto syn: preSynapses )
+    _processTasks( pending , false );
+
+    pending.clear( );
+    for ( auto& task: _neuronTasks )
     {
-      auto sectionPre = syn->preSynapticSection( );
-      if ( sectionPre )
+      if ( task.second.treePost && task.second.sections &&
+           task.second.postsynapticSynapses.empty( ))
+        pending.push_back( &task.second );
+    }
+
+    const int taskCount = static_cast< int >( pending.size( ));
+
+    // Dynamic paths look every postsynaptic synapse up from its partner.
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < taskCount; ++i )
+    {
+      auto& task = *pending[ i ];
+      const auto& table = *task.sections;
+      for ( unsigned int j = 0; j < table.size( ); ++j )
       {
-        auto treePre = _treePre.find( syn->preSynapticNeuron( ));
-        if ( treePre == _treePre.end( ))
+        for ( const auto& sectionSynapse: table.synapses( j ))
         {
-          auto tree = ConnectivityTree( );
-          treePre =
-            _treePre.insert(
-              std::make_pair( syn->preSynapticNeuron( ) , tree )).first;
+          if ( sectionSynapse.type == POSTSYNAPTIC )
+            task.postsynapticSynapses.insert(
+              std::make_pair( sectionSynapse.synapse , sectionSynapse ));
+        }
+      }
+    }
+  }
+
+  bool PathFinder::exportPaths( const gidVec& gids , PathChunkWriter& writer ,
+                                float pointSize , unsigned int batchSize ,
+                                const std::function< bool( size_t ) >& progress )
+  {
+    batchSize = std::max( batchSize , 1u );
+
+    for ( size_t first = 0; first < gids.size( ); first += batchSize )
+    {
+      const auto last = std::min( gids.size( ) , first + batchSize );
+      const gidUSet batch( gids.begin( ) + first , gids.begin( ) + last );
 
+      tsynapseVec preSynapses;
+      tsynapseVec postSynapses;
+      _calculateSynapses( batch , batch , gidUSet( ) , gidUSet( ) ,
+                          preSynapses , postSynapses );
+
+      auto tasks = _createTasks( preSynapses , postSynapses );
+
+      // Everything of the batch is local, released before the next one.
+      std::deque< ConnectivityTree > trees;
+      std::deque< SectionTable > tables;
+      std::vector< NeuronPathTask* > pending;
+      for ( auto& item: tasks )
+      {
+        auto& task = item.second;
+        if ( !task.preSynapses.empty( ))
+        {
+          trees.emplace_back( );
+          task.treePre = &trees.back( );
         }
+        if ( !task.postSynapses.empty( ))
+        {
+          trees.emplace_back( );
+          task.treePost = &trees.back( );
+        }
+        tables.emplace_back( );
+        task.sections = &tables.back( );
+
+        pending.push_back( &task );
+      }
+
+      const int taskCount = static_cast< int >( pending.size( ));
+
+#pragma omp parallel for schedule(dynamic)
+      for ( int i = 0; i < taskCount; ++i )
+      {
+        auto& task = *pending[ i ];
+        _populateTrees( task );
+        _processSections( task );
+        _processEndSections( task );
+        _createPaths( task , pointSize , _adaptiveSampling );
+      }
+
+      for ( const auto task: pending )
+      {
+        writer.add( PRESYNAPTIC , task->preOut );
+        writer.add( POSTSYNAPTIC , task->postOut );
+
+        if ( _neuronTasks.find( task->gid ) == _neuronTasks.end( ))
+          _geometry.release( task->gid );
+      }
+
+      if ( !progress( last ))
+        return false;
+    }
+
+    return true;
+  }
+
+  void PathFinder::cache( PathCache* cache_ )
+  {
+    _cache = cache_;
+  }
+
+  QString PathFinder::_cacheKey( const NeuronPathTask& task ) const
+  {
+    return _cache->key( task.gid , task.preSynapses , task.postSynapses ,
+                        { _pointSize , _sampledAdaptive ? 1.0f : 0.0f ,
+                          _geometry.tolerance( ) });
+  }
+
+  void PathFinder::_processTasks( const std::vector< NeuronPathTask* >& pending ,
+                                  bool sample )
+  {
+    const int taskCount = static_cast< int >( pending.size( ));
+
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < taskCount; ++i )
+      _populateTrees( *pending[ i ] );
+
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < taskCount; ++i )
+      _processSections( *pending[ i ] );
+
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < taskCount; ++i )
+      _processEndSections( *pending[ i ] );
+
+    if ( sample )
+    {
+#pragma omp parallel for schedule(dynamic)
+      for ( int i = 0; i < taskCount; ++i )
+        _createPaths( *pending[ i ] , _pointSize , _sampledAdaptive );
+    }
 
-        if ( !treePre->second.hasNode( sectionPre ))
+#ifdef DEBUG
+    if ( sample && _sampledAdaptive && !pending.empty( ))
+    {
+      size_t adaptiveParticles = 0;
+      size_t uniformParticles = 0;
+      for ( const auto task: pending )
+      {
+        adaptiveParticles += task->preOut.size( ) + task->postOut.size( );
+        uniformParticles += task->uniformParticles;
+      }
+
+      std::cout << "Adaptive path sampling: " << adaptiveParticles
+                << " particles instead of " << uniformParticles << " ("
+                << ( uniformParticles > 0 ?
+                     100.0f * ( 1.0f - static_cast< float >( adaptiveParticles )
+                                / uniformParticles ) : 0.0f )
+                << "% fewer)." << std::endl;
+    }
+#endif
+
+    for ( const auto task: pending )
+    {
+      _somaSynapses.insert( task->somaSynapses.begin( ) ,
+                            task->somaSynapses.end( ));
+
+      task->processed = true;
+    }
+  }
+
+  void PathFinder::adaptiveSampling( bool state )
+  {
+    _adaptiveSampling = state;
+  }
+
+  bool PathFinder::adaptiveSampling( void ) const
+  {
+    return _adaptiveSampling;
+  }
+
+  void PathFinder::simplification( float tolerance )
+  {
+    _simplification = std::max( 0.0f , tolerance );
+  }
+
+  float PathFinder::simplification( void ) const
+  {
+    return _simplification;
+  }
+
+  const NeuronPathTask* PathFinder::neuronPaths( unsigned int gid ) const
+  {
+    auto it = _neuronTasks.find( gid );
+    if ( it == _neuronTasks.end( ))
+      return nullptr;
+
+    return &it->second;
+  }
+
+  std::map< unsigned int , NeuronPathTask >
+  PathFinder::_createTasks( const tsynapseVec& preSynapses ,
+                            const tsynapseVec& postSynapses ) const
+  {
+    std::map< unsigned int , NeuronPathTask > tasks;
+
+    auto task = [ & ]( unsigned int gid ) -> NeuronPathTask&
+    {
+      auto it = tasks.find( gid );
+      if ( it == tasks.end( ))
+        it = tasks.insert( std::make_pair( gid , NeuronPathTask( gid ))).first;
+
+      return it->second;
+    };
+
+    for ( auto syn: preSynapses )
+      task( syn->preSynapticNeuron( )).preSynapses.push_back( syn );
+
+    for ( auto syn: postSynapses )
+      task( syn->postSynapticNeuron( )).postSynapses.push_back( syn );
+
+    return tasks;
+  }
+
+  void PathFinder::_removeTask( const NeuronPathTask& task )
+  {
+    _treePre.erase( task.gid );
+    _treePost.erase( task.gid );
+    _sectionTables.erase( task.gid );
+
+    for ( auto synapse: task.somaSynapses )
+      _somaSynapses.erase( synapse );
+  }
+
+  void PathFinder::_populateTrees( NeuronPathTask& task )
+  {
+    for ( auto syn: task.preSynapses )
+    {
+      auto sectionPre = syn->preSynapticSection( );
+      if ( sectionPre )
+      {
+        if ( !task.treePre->hasNode( sectionPre ))
         {
           auto sections = pathToSoma( sectionPre );
-          treePre->second.addBranch( sections );
+          task.treePre->addBranch( sections );
         }
       }
       else
@@ -114,27 +421,17 @@ namespace syncopa
       }
     }
 
-    for ( auto syn: postSynapses )
+    for ( auto syn: task.postSynapses )
     {
       auto sectionPost = syn->postSynapticSection( );
       if ( sectionPost ||
            syn->synapseType( ) == nsol::MorphologySynapse::AXOSOMATIC )
       {
-        auto treePost = _treePost.find( syn->postSynapticNeuron( ));
-        if ( treePost == _treePost.end( ))
-        {
-          auto tree = ConnectivityTree( );
-          treePost =
-            _treePost.insert(
-              std::make_pair( syn->postSynapticNeuron( ) , tree )).first;
-
-        }
-
-        if ( !treePost->second.hasNode( sectionPost ))
+        if ( !task.treePost->hasNode( sectionPost ))
         {
           auto postSections = pathToSoma( sectionPost );
 
-          treePost->second.addBranch( postSections );
+          task.treePost->addBranch( postSections );
         }
       }
       else
@@ -145,6 +442,12 @@ namespace syncopa
                   << std::endl;
       }
     }
+
+    if ( task.treePre )
+      task.treePre->finalize( );
+
+    if ( task.treePost )
+      task.treePost->finalize( );
   }
 
   const std::unordered_map< unsigned int , ConnectivityTree >&
@@ -160,25 +463,23 @@ namespace syncopa
     _treePre.clear( );
     _treePost.clear( );
 
-    _pathsPre.clear( );
-    _pathsPost.clear( );
-
-    _infoSections.clear( );
+    _sectionTables.clear( );
+    _somaSynapses.clear( );
+    _neuronTasks.clear( );
 
     _maxDepth = 0;
   }
 
-
   void PathFinder::_calculateSynapses(
-    const std::vector< nsol::SynapsePtr >& synapses ,
     const std::unordered_set< unsigned int >& preNeuronsWithAllPaths ,
     const std::unordered_set< unsigned int >& postNeuronsWithAllPaths ,
     const std::unordered_set< unsigned int >& preNeuronsWithConnectedPaths ,
     const std::unordered_set< unsigned int >& postNeuronsWithConnectedPaths ,
-    tsynapseVec& outUsedSynapses ,
     tsynapseVec& outUsedPreSynapses ,
     tsynapseVec& outUsedPostSynapses ) const
   {
+    if ( !_synapseIndex )
+      return;
 
     auto contains = [ ]( const std::unordered_set< unsigned int >& set ,
                          unsigned int value )
@@ -186,40 +487,40 @@ namespace syncopa
       return set.find( value ) != set.cend( );
     };
 
-    for ( auto syn: synapses )
+    // Presynaptic paths only come from synapses of the selected
+    // presynaptic neurons, and postsynaptic paths from the synapses of the
+    // selected postsynaptic ones, so only their index rows are visited.
+    gidUSet preNeurons( preNeuronsWithAllPaths.begin( ) ,
+                        preNeuronsWithAllPaths.end( ));
+    preNeurons.insert( preNeuronsWithConnectedPaths.begin( ) ,
+                       preNeuronsWithConnectedPaths.end( ));
+
+    gidUSet postNeurons( postNeuronsWithAllPaths.begin( ) ,
+                         postNeuronsWithAllPaths.end( ));
+    postNeurons.insert( postNeuronsWithConnectedPaths.begin( ) ,
+                        postNeuronsWithConnectedPaths.end( ));
+
+    for ( const auto pre: preNeurons )
     {
-      auto morphSyn = dynamic_cast<nsol::MorphologySynapse*>(syn);
-      if ( morphSyn == nullptr ) continue;
-
-      auto pre = syn->preSynapticNeuron( );
-      auto post = syn->postSynapticNeuron( );
-      bool add = false;
-
-      // Pre-synaptic paths
-      if ( contains( preNeuronsWithAllPaths , pre )
-           || ( contains( preNeuronsWithConnectedPaths , pre )
-                && ( contains( postNeuronsWithAllPaths , post )
-                     || contains( postNeuronsWithConnectedPaths , post ))))
-      {
-        add = true;
-        outUsedPreSynapses.push_back( morphSyn );
-      }
+      const bool allPaths = contains( preNeuronsWithAllPaths , pre );
 
-      // Post-synaptic paths
-      if ( contains( postNeuronsWithAllPaths , post )
-           || ( contains( postNeuronsWithConnectedPaths , post )
-                && ( contains( preNeuronsWithAllPaths , pre )
-                     || contains( preNeuronsWithConnectedPaths , pre ))))
+      for ( const auto syn: _synapseIndex->presynaptic( pre ))
       {
-        add = true;
-        outUsedPostSynapses.push_back( morphSyn );
+        if ( allPaths || contains( postNeurons , syn->postSynapticNeuron( )))
+          outUsedPreSynapses.push_back( syn );
       }
+    }
+
+    for ( const auto post: postNeurons )
+    {
+      const bool allPaths = contains( postNeuronsWithAllPaths , post );
 
-      if ( add )
+      for ( const auto syn: _synapseIndex->postsynaptic( post ))
       {
-        outUsedSynapses.push_back( morphSyn );
+        if ( allPaths || contains( preNeurons , syn->preSynapticNeuron( )))
+          outUsedPostSynapses.push_back( syn );
       }
-    } // for synapses
+    }
   }
 
   void PathFinder::_createPath(
@@ -227,11 +528,17 @@ namespace syncopa
     std::vector< vec3 >& result ,
     nsol::MorphologySynapse* syn ,
     TNeuronConnection type ,
-    float pointSize ) const
+    const SectionTable* table ,
+    float pointSize ,
+    bool adaptive ,
+    size_t& uniformParticles ) const
   {
+    // Adaptive spacing, relative to the uniform one.
+    static const float maxStepFactor = 4.0f;
+    static const float toleranceFactor = 0.5f;
+
     auto currentGid = type == PRESYNAPTIC ? syn->preSynapticNeuron( )
                                           : syn->postSynapticNeuron( );
-    auto transform = getTransform( currentGid );
     auto sectionNodes = pathToSoma( syn , type );
     for ( auto section: sectionNodes )
     {
@@ -239,34 +546,99 @@ namespace syncopa
         continue;
       insertedSections.insert( section );
 
-      nsol::Nodes& nodes = section->nodes( );
       utils::PolylineInterpolation pathPoints;
-      auto parsedSection = _infoSections.find( section );
-      if ( parsedSection != _infoSections.end( ) &&
-           std::get< tsi_leafSection >( parsedSection->second ))
+      const auto index = table ? table->find( section )
+                               : SectionTable::invalidIndex;
+      if ( table && table->isCut( index ))
       {
-        auto points = std::get< tsi_fixedSection >( parsedSection->second );
-        pathPoints.insert( points );
+        for ( const auto& node: table->cutNodes( index ))
+          pathPoints.insert( node );
       }
       else
       {
-        for ( auto node: nodes )
-          pathPoints.insert( transformPoint( node->point( ) , transform ));
+        pathPoints = _geometry.section( currentGid , section );
+      }
+
+      if ( !adaptive )
+      {
+        pathPoints.sampleUniform( pointSize , result );
+        continue;
       }
 
-      float currentDist = 0;
-      float accDist = pathPoints.totalDistance( );
-      while ( currentDist < accDist )
+      std::vector< float > synapseDistances;
+      if ( table && index != SectionTable::invalidIndex )
       {
-        vec3 pos = pathPoints.pointAtDistance( currentDist );
-        result.push_back( pos );
+        for ( const auto& sectionSynapse: table->synapses( index ))
+          synapseDistances.push_back( sectionSynapse.distance );
+      }
 
-        currentDist += pointSize;
-      } // while
+      uniformParticles += pathPoints.sampleCount( pointSize );
+      pathPoints.sampleAdaptive( pointSize , pointSize * maxStepFactor ,
+                                 pointSize * toleranceFactor ,
+                                 synapseDistances ,
+                                 pointSize * maxStepFactor , result );
     } // for section
   }
 
 
+  void PathFinder::_createPaths( NeuronPathTask& task , float pointSize ,
+                                 bool adaptive ) const
+  {
+    task.uniformParticles = 0;
+
+    std::unordered_set< nsol::NeuronMorphologySectionPtr > insertedSections;
+    for ( const auto& synapse: task.preSynapses )
+    {
+      _createPath( insertedSections , task.preOut , synapse , PRESYNAPTIC ,
+                   task.sections , pointSize , adaptive ,
+                   task.uniformParticles );
+    }
+
+    for ( const auto& synapse: task.postSynapses )
+    {
+      _createPath( insertedSections , task.postOut , synapse , POSTSYNAPTIC ,
+                   task.sections , pointSize , adaptive ,
+                   task.uniformParticles );
+    }
+  }
+  void PathFinder::_postsynapticHead(
+    const SectionSynapse& sectionSynapse ,
+    const utils::PolylineInterpolation& sectionPath , tPosVec& points )
+  {
+    points.push_back( sectionSynapse.position );
+    for ( int j = static_cast< int >( sectionSynapse.segment ); j >= 0; --j )
+      points.push_back( sectionPath[ j ] );
+  }
+
+  bool PathFinder::postsynapticSections( nsolMSynapse_ptr synapse ,
+                                         tPosVec& head ,
+                                         tCNodeVec& sections ) const
+  {
+    const auto task = neuronPaths( synapse->postSynapticNeuron( ));
+    if ( !task || !task->treePost || !task->sections )
+      return false;
+
+    const auto section =
+      dynamic_cast< nsolMSection_ptr >( synapse->postSynapticSection( ));
+    const auto node = task->treePost->node( section );
+    if ( !node )
+      return false;
+
+    const auto sectionSynapse = task->postsynapticSynapses.find( synapse );
+    if ( sectionSynapse == task->postsynapticSynapses.end( ))
+      return false;
+
+    head.clear( );
+    _postsynapticHead( sectionSynapse->second ,
+                       _geometry.section( task->gid , section ) , head );
+
+    sections.clear( );
+    for ( auto parent = node->parent( ); parent; parent = parent->parent( ))
+      sections.push_back( parent );
+
+    return true;
+  }
+
   std::vector< nsol::NeuronMorphologySectionPtr >
   PathFinder::pathToSoma( const nsolMSynapse_ptr synapse ,
                           syncopa::TNeuronConnection type ) const
@@ -294,43 +666,24 @@ namespace syncopa
     return sections;
   }
 
-  mat4 PathFinder::getTransform( unsigned int gid ) const
+  const mat4& PathFinder::getTransform( unsigned int gid ) const
   {
-    nsol::NeuronsMap& neurons = _dataset->neurons( );
-    auto neuron = neurons.find( gid );
-    if ( neuron == neurons.end( ))
-      return mat4::Ones( );
-
-    return neuron->second->transform( );
+    return _geometry.transform( gid );
   }
 
-
-  std::vector< vec3 >
-  PathFinder::_cutEndSection( const std::vector< vec3 >& nodes ,
-                              const vec3& synapsePos ,
-                              unsigned int lastIndex ) const
+  const SectionGeometryStore& PathFinder::geometry( void ) const
   {
-    std::vector< vec3 > result;
-    for ( unsigned int i = 0; i < lastIndex + 1; ++i )
-    {
-      result.push_back( nodes[ i ] );
-    }
-    result.push_back( synapsePos );
-
-    return result;
+    return _geometry;
   }
 
-  void PathFinder::_processSections(
-    const std::vector< nsolMSynapse_ptr >& preSynapses ,
-    const std::vector< nsolMSynapse_ptr >& postSynapses )
+  void PathFinder::_processSections( NeuronPathTask& task )
   {
-    _infoSections.clear( );
-    _somaSynapses.clear( );
+    SectionTable& table = *task.sections;
 
     auto lambda = [ & ](
       const nsol::MorphologySynapsePtr synapse ,
+      TNeuronConnection type ,
       unsigned int neuronGID ,
-      const mat4& transform ,
       const nsol::NeuronMorphologySectionPtr section ,
       const tBrainSynapse& synapseFixInfo )
     {
@@ -343,79 +696,53 @@ namespace syncopa
         return;
       }
 
-      unsigned int segmentIndex = std::get< TBS_SEGMENT_INDEX >(
-        synapseFixInfo );
-      const auto& nodes = section->nodes( );
+      const auto& sectionPath = _geometry.section( neuronGID , section );
+
+      // Segment indices refer to the nsol nodes, remapped to the stored
+      // and possibly simplified section.
+      float distance = std::get< TBS_SEGMENT_DISTANCE >( synapseFixInfo );
+      unsigned int segmentIndex = _geometry.segment(
+        neuronGID , section , std::get< TBS_SEGMENT_INDEX >( synapseFixInfo ) ,
+        distance );
 
-      if ( nodes.empty( ) || nodes.size( ) == 1 )
+      if ( sectionPath.size( ) < 2 )
       {
         std::cout << "ERROR: Section " << section->id( )
-                  << " with " << nodes.size( )
+                  << " with " << sectionPath.size( )
                   << " nodes." << std::endl;
         return;
       }
 
-      if ( segmentIndex >= nodes.size( ) - 1 )
+      if ( segmentIndex >= sectionPath.size( ) - 1 )
       {
         std::cout << "ERROR: " << neuronGID << " Segment index "
-                  << segmentIndex
+                  << std::get< TBS_SEGMENT_INDEX >( synapseFixInfo )
                   << " is greater than section " << section->id( )
-                  << " nodes number " << nodes.size( )
+                  << " nodes number " << sectionPath.size( )
                   << " distance "
                   << std::get< TBS_SEGMENT_DISTANCE >( synapseFixInfo )
                   << std::endl;
         return;
       }
 
-      float distance = std::get< TBS_SEGMENT_DISTANCE >( synapseFixInfo );
-      vec3 start = nodes[ segmentIndex ]->point( );
-      vec3 end = nodes[ segmentIndex + 1 ]->point( );
+      vec3 start = sectionPath[ segmentIndex ];
+      vec3 end = sectionPath[ segmentIndex + 1 ];
 
       float length = ( end - start ).norm( );
 
       float normalized = distance / length;
 
-      vec3 synapsePos = transformPoint(
-        end * normalized + start * ( 1 - normalized ) , transform );
-
-      auto it = _infoSections.find( section );
-      if ( it == _infoSections.end( ))
-      {
-        utils::PolylineInterpolation interpolator;
-
-        for ( auto node: section->nodes( ))
-          interpolator.insert( transformPoint( node->point( ) , transform ));
-
-        std::unordered_map< nsol::MorphologySynapsePtr ,
-          tFixedSynapseInfo > synapseSet;
-
-        float sectionDist = interpolator.totalDistance( );
-
-        std::vector< vec3 > fixedSection;
-
-        tSectionInfo data =
-          std::make_tuple( synapseSet , sectionDist ,
-                           false ,
-                           fixedSection , interpolator );
-
-        it = _infoSections.insert( std::make_pair( section , data )).first;
+      SectionSynapse sectionSynapse;
+      sectionSynapse.synapse = synapse;
+      sectionSynapse.type = type;
+      sectionSynapse.position = end * normalized + start * ( 1 - normalized );
+      sectionSynapse.distance = sectionPath.distance( segmentIndex ) + distance;
+      sectionSynapse.segment = segmentIndex;
 
-      } // if section not found
-
-      auto& synapseMap = std::get< tsi_Synapses >( it->second );
-      auto& interpolator = std::get< tsi_Interpolator >( it->second );
-      float composedDistance = interpolator.distance( segmentIndex );
-
-      composedDistance += distance;
-
-      tFixedSynapseInfo fixedSynInfo =
-        std::make_tuple( synapsePos , composedDistance , 0 , segmentIndex ,
-                         true );
-
-      synapseMap.insert( std::make_pair( synapse , fixedSynInfo ));
+      table.addSynapse( table.add( section ) , sectionSynapse );
     };
 
-    for ( const auto& synapse: preSynapses )
+    for ( const auto& synapse: task.preSynapses )
     {
       if ( !synapse->preSynapticSection( ))
       {
@@ -433,14 +760,13 @@ namespace syncopa
       }
 
       auto neuronGid = synapse->preSynapticNeuron( );
-      auto transform = getTransform( neuronGid );
       auto section = synapse->preSynapticSection( );
       const auto& fixInfo = std::get< TBSI_PRESYNAPTIC >( synInfo->second );
 
-      lambda( synapse , neuronGid , transform , section , fixInfo );
+      lambda( synapse , PRESYNAPTIC , neuronGid , section , fixInfo );
     }
 
-    for ( const auto& synapse: postSynapses )
+    for ( const auto& synapse: task.postSynapses )
     {
       if ( !synapse->postSynapticSection( ) &&
            synapse->synapseType( ) != nsol::MorphologySynapse::AXOSOMATIC )
@@ -459,311 +785,77 @@ namespace syncopa
       }
 
       auto neuronGid = synapse->postSynapticNeuron( );
-      auto transform = getTransform( neuronGid );
       auto section = synapse->postSynapticSection( );
       const auto& fixInfo = std::get< TBSI_POSTSYNAPTIC >( synInfo->second );
 
       if ( !section &&
            synapse->synapseType( ) == nsol::MorphologySynapse::AXOSOMATIC )
       {
-        _somaSynapses.insert( synapse );
+        task.somaSynapses.push_back( synapse );
         std::cout << "Found somatic synapse " << synapse->gid( ) << std::endl;
         continue;
       }
 
-      lambda( synapse , neuronGid , transform , section , fixInfo );
+      lambda( synapse , POSTSYNAPTIC , neuronGid , section , fixInfo );
     }
+
+    table.finalize( );
   }
 
-  void PathFinder::_processEndSections(
-    const std::vector< nsolMSynapse_ptr >& preSynapses ,
-    const std::vector< nsolMSynapse_ptr >& postSynapses )
+  void PathFinder::_processEndSections( NeuronPathTask& task )
   {
+    SectionTable& table = *task.sections;
 
-    auto lambda = [ & ]( const unsigned int gid, ConnectivityTree* tree )
+    // Leaf sections of both trees, each one listed once. Trimming only
+    // depends on the trees, not on the synapses that added each branch.
+    std::vector< unsigned int > endSections;
+    std::vector< bool > listed( table.size( ) , false );
+
+    auto lambda = [ & ]( const ConnectivityTree* tree )
     {
-      auto endSections = tree->leafNodes( );
-      if ( endSections.empty( ))
-        std::cerr << "ERROR: " << gid << " leaf nodes ARE EMPTY!" << std::endl;
+      const auto& leaves = tree->leafNodes( );
+      if ( leaves.empty( ))
+        std::cerr << "ERROR: " << task.gid << " leaf nodes ARE EMPTY!" << std::endl;
 
-      for ( auto node: endSections )
+      for ( auto node: leaves )
       {
         auto section = node->section( );
 
-        auto it = _infoSections.find( section );
-        if ( it == _infoSections.end( ))
+        const auto index = table.find( section );
+        if ( index == SectionTable::invalidIndex )
         {
           std::cerr << "Section " << section->id( ) << " not parsed correctly."
                     << std::endl;
           continue;
         }
 
-        tSectionInfo& data = it->second;
-
-        float maxDistance = 0;
-
-        const auto sectionSynapses = std::get< tsi_Synapses >( data );
-
-        if ( sectionSynapses.empty( ))
+        if ( listed[ index ] )
           continue;
 
-        // Calculate farthest synapse distance on the section
-        auto syn = sectionSynapses.cbegin( );
-        auto farthestSynapse = syn;
-        for ( ; syn != sectionSynapses.cend( ); ++syn )
-        {
-          float synapseDistanceOnSection =
-            std::get< tpi_distance >( syn->second );
-
-          if ( synapseDistanceOnSection > maxDistance )
-          {
-            maxDistance = synapseDistanceOnSection;
-            farthestSynapse = syn;
-          }
-        }
-
-        const tFixedSynapseInfo synapseInfo = farthestSynapse->second;
-
-        const vec3 synapsePos = std::get< tpi_position >( synapseInfo );
-        const unsigned int index = std::get< tpi_index >( synapseInfo );
-
-        const std::vector< vec3 > fixedSection =
-          _cutEndSection( std::get< tsi_Interpolator >( data ).positions( ) ,
-                          synapsePos , index );
+        listed[ index ] = true;
+        endSections.push_back( index );
+      }
+    };
 
-        std::get< tsi_fixedSection >( data ) = fixedSection;
-        std::get< tsi_leafSection >( data ) = true;
+    if ( task.treePre )
+      lambda( task.treePre );
 
-      } // for each end section
-    };
+    if ( task.treePost )
+      lambda( task.treePost );
 
-    for ( const auto& synapse: preSynapses )
+    for ( auto index: endSections )
     {
-      auto neuron = synapse->preSynapticNeuron( );
-      auto treeIt = _treePre.find( neuron );
-      if ( treeIt == _treePre.end( ))
-      {
-        std::cerr << "ERROR: Pre tree for neuron " << neuron << " NOT FOUND"
-                  << std::endl;
+      if ( table.isCut( index ))
         continue;
-      }
-      lambda( neuron , &treeIt->second );
-    }
 
-    for ( const auto& synapse: postSynapses )
-    {
-      auto neuron = synapse->postSynapticNeuron( );
-      auto treeIt = _treePost.find( neuron );
-      if ( treeIt == _treePost.end( ))
-      {
-        std::cerr << "ERROR: Post tree for neuron " << neuron << " NOT FOUND"
-                  << std::endl;
+      const auto sectionSynapses = table.synapses( index );
+      if ( sectionSynapses.empty( ))
         continue;
-      }
-      lambda( neuron , &treeIt->second );
-    }
-  }
 
-  void PathFinder::addPostsynapticPath( nsol::MorphologySynapsePtr synapse ,
-                                        const tPosVec& nodes )
-  {
-    utils::PolylineInterpolation interpolator( nodes );
-
-    _pathsPost.insert( std::make_pair( synapse , interpolator ));
-  }
-
-
-  std::pair< unsigned int , cnode_ptr >
-  PathFinder::node( unsigned int sectionID ) const
-  {
-
-    for ( const auto& item: _treePre )
-    {
-      auto result = item.second.node( sectionID );
-      if ( result != nullptr ) return std::make_pair( item.first , result );
-    }
-
-    return std::make_pair( 0 , nullptr );
-  }
-
-  utils::EventPolylineInterpolation
-  PathFinder::computeDeepestPathFrom( unsigned originNeuron, ConnectivityNode* origin )
-  {
-    utils::EventPolylineInterpolation interpolator;
-
-    std::vector< ConnectivityNode* > pathSections;
-    pathSections.reserve( origin->childrenMaxDepth( ) + 1 );
-    pathSections.push_back( origin );
-
-    auto firstPath = origin->deepestPath( );
-
-    for ( auto pathSection: firstPath )
-    {
-      pathSections.push_back( pathSection );
-    }
-
-    //      std::cout << "Found deepest path with " << pathSections.size( )
-    //                << " out of " << origin->childrenMaxDepth( )
-    //                << std::endl;
-
-    auto transform = getTransform( originNeuron );
-
-    cnode_ptr last = nullptr;
-    for ( auto currentSection: pathSections )
-    {
-      //        std::cout << " " << connectivityNode->section( )->id( )
-      //                  << ":" << interpolator.totalDistance( )
-      //                  << "->" << ( connectivityNode->numberOfChildren( ) )
-      //                  << std::endl;
-
-      float prevDist = interpolator.totalDistance( );
-
-      //TODO Check if leaf section and add cut end
-      auto infoSection = _infoSections.find( currentSection->section( ));
-      if ( infoSection != _infoSections.end( ) &&
-           std::get< tsi_leafSection >( infoSection->second ))
-      {
-        auto fixedSection = std::get< tsi_fixedSection >(
-          infoSection->second );
-
-        interpolator.insert( fixedSection );
-
-        //          std::cout << "Fixed ";
-        //          for( auto node : fixedSection )
-        //            std::cout << node << std::endl;
-      }
-      else
-      {
-        for ( auto node: currentSection->section( )->nodes( ))
-        {
-          auto point = transformPoint( node->point( ) , transform );
-
-          interpolator.insert( point );
-        }
-
-        if ( last && last->numberOfChildren( ) > 1 )
-        {
-          //          auto children = last->children( );
-          //          for( auto child = children.begin( ) + 1; child != children.end( ); ++child )
-          {
-            interpolator.addEventNode( prevDist , last->section( )->id( ));
-          }
-        }
-      }
-
-      if ( infoSection != _infoSections.end( ))
-      {
-        const auto& sectionSynapses = std::get< tsi_Synapses >(
-          infoSection->second );
-        for ( auto synapse: sectionSynapses )
-        {
-          auto it = _synapseFixInfo->find( synapse.first );
-          if ( it != _synapseFixInfo->end( ))
-          {
-            auto presynInfo = std::get< TBSI_PRESYNAPTIC >( it->second );
-
-            float synapseDist =
-                std::get< TBS_SEGMENT_DISTANCE >( presynInfo );
-
-
-            unsigned int segmentIndex = std::get< TBS_SEGMENT_INDEX >(
-              presynInfo );
-            const auto& sectionInterp =
-                std::get< tsi_Interpolator >( infoSection->second );
-
-            float sectionDist = sectionInterp.distance( segmentIndex );
-
-            uintptr_t intPointer = reinterpret_cast< uintptr_t >( synapse.first );
-
-            std::cout << "Adding synapse event " << synapse.first->gid( )
-                << " segment dist " << synapseDist
-                << " section dist " << sectionDist
-                << " current dist " << prevDist
-                << std::endl;
-
-            synapseDist += prevDist;
-            synapseDist += sectionDist;
-
-            if ( _pathsPost.find( synapse.first ) == _pathsPost.end( ) &&
-                 synapse.first->synapseType( ) !=
-                 nsol::MorphologySynapse::AXOSOMATIC )
-            {
-              auto postSections = pathToSoma( synapse.first , POSTSYNAPTIC );
-              // TODO cut leaf section (first)
-
-              auto postTransform = getTransform(
-                synapse.first->postSynapticNeuron( ));
-
-              tPosVec points;
-
-              auto fixedSection = _infoSections.find( postSections.front( ));
-              if ( fixedSection == _infoSections.end( ))
-              {
-                std::cerr << "ERROR: Postsynaptic section "
-                    << postSections.front( )->id( )
-                    << " info not found." << std::endl;
-                continue;
-              }
-
-              auto sectionEndNodes =
-                  std::get< tsi_fixedSection >( fixedSection->second );
-
-              for ( auto nodeIt = sectionEndNodes.rbegin( );
-                    nodeIt != sectionEndNodes.rend( ); ++nodeIt )
-                points.emplace_back( *nodeIt );
-
-              for ( unsigned int i = 1; i < postSections.size( ); ++i )
-              //                for( auto sec : postSections )
-              {
-                auto sec = postSections[ i ];
-
-                for ( auto nodeit = sec->nodes( ).rbegin( );
-                      nodeit != sec->nodes( ).rend( ); ++nodeit )
-                  //                    for( auto nodeit = sec->nodes( ).begin( ); nodeit != sec->nodes( ).end( ); ++nodeit )
-                  points.emplace_back(
-                    transformPoint(( *nodeit )->point( ) , postTransform ));
-              }
-
-              _pathsPost.insert( std::make_pair( synapse.first , points ));
-
-              std::cout << "Added post path " << synapse.first
-                  << " with " << points.size( ) << std::endl;
-
-            }
-
-            if ( synapseDist > interpolator.totalDistance( ))
-            {
-              std::cout << "--Fixing synapse dist " << synapseDist
-                  << " to " << interpolator.totalDistance( )
-                  << std::endl;
-
-              synapseDist = interpolator.totalDistance( );
-            }
-            interpolator.addEventNode( synapseDist , intPointer ,
-                                       utils::TEvent_synapse );
-          }
-        }
-      }
-
-      currentSection->sectionLength(
-        interpolator.totalDistance( ) - prevDist );
-
-      last = currentSection;
+      // Synapses are sorted by distance, the farthest one is the last.
+      table.cut( index , _geometry.section( task.gid , table.section( index )) ,
+                 sectionSynapses.back( ));
     }
-
-    return interpolator;
-  }
-
-  utils::EventPolylineInterpolation
-  PathFinder::getPostsynapticPath( nsolMSynapse_ptr synapse ) const
-  {
-    auto it = _pathsPost.find( synapse );
-    if ( it == _pathsPost.end( ))
-    {
-      return { };
-    }
-
-    return it->second;
   }
 
   std::vector< vec3 >
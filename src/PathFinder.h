@@ -13,45 +13,61 @@
 #include "types.h"
 
 #include <unordered_set>
+#include <deque>
+#include <functional>
+#include <map>
 
 #include <nsol/nsol.h>
 
 #include "PolylineInterpolation.hpp"
 #include "ConnectivityTree.h"
+#include "SectionGeometryStore.h"
+#include "SynapseIndex.h"
+#include "SectionTable.h"
+#include "PathCache.h"
+#include "PathChunkFile.h"
 
 namespace syncopa
 {
-  enum tSectionInfoFields
-  {
-    tsi_Synapses = 0 ,
-    tsi_length ,
-    tsi_leafSection ,
-    tsi_fixedSection ,
-    tsi_Interpolator
-  };
+  typedef std::unordered_set< nsol::NeuronMorphologySectionPtr > tSectionsMap;
 
-  enum tProjectionInfo
+  /*! Work of a single neuron while configuring the paths. Every stage of
+   * the configuration only touches the data of its own neuron, so tasks
+   * are processed concurrently. */
+  struct NeuronPathTask
   {
-    tpi_position = 0 ,
-    tpi_distance ,
-    tpi_distanceOnSection ,
-    tpi_index ,
-    tpi_found
-  };
+    unsigned int gid;
 
-  typedef std::tuple< vec3 , float , float , unsigned int , bool > tFixedSynapseInfo;
+    tsynapseVec preSynapses;
+    tsynapseVec postSynapses;
 
-  typedef std::tuple< std::unordered_map< nsol::MorphologySynapsePtr ,
-    tFixedSynapseInfo > ,
-    float ,
-    bool ,
-    std::vector< vec3 > ,
-    utils::PolylineInterpolation > tSectionInfo;
+    ConnectivityTree* treePre;
+    ConnectivityTree* treePost;
+    SectionTable* sections;
 
-  typedef std::unordered_map< nsol::NeuronMorphologySectionPtr ,
-    tSectionInfo > tSectionsInfoMap;
+    tsynapseVec somaSynapses;
 
-  typedef std::unordered_set< nsol::NeuronMorphologySectionPtr > tSectionsMap;
+    std::vector< vec3 > preOut;
+    std::vector< vec3 > postOut;
+
+    //! Particles uniform spacing would have placed, in adaptive sampling.
+    size_t uniformParticles;
+
+    //! False while only the particles are known, loaded from the cache.
+    bool processed;
+
+    //! Postsynaptic synapses of the neuron, indexed by prepareDynamicPaths.
+    std::unordered_map< nsolMSynapse_ptr , SectionSynapse > postsynapticSynapses;
+
+    NeuronPathTask( unsigned int gid_ )
+      : gid( gid_ )
+      , treePre( nullptr )
+      , treePost( nullptr )
+      , sections( nullptr )
+      , uniformParticles( 0 )
+      , processed( false )
+    { }
+  };
 
   class PathFinder
   {
@@ -61,17 +77,58 @@ namespace syncopa
 
     ~PathFinder( void );
 
-    void dataset( nsol::DataSet* dataset_ , const TSynapseInfo* synapseInfo );
+    void dataset( nsol::DataSet* dataset_ , const TSynapseInfo* synapseInfo ,
+                  const SynapseIndex* synapseIndex );
 
-    void configure( const std::vector< nsol::SynapsePtr >& synapses ,
-                    const std::unordered_set< unsigned int >& preNeuronsWithAllPaths ,
+    /*! Updates the paths to the given neuron sets. Neurons whose synapses
+     * did not change since the previous call keep their paths. Neurons
+     * whose paths disappeared or changed are added to removedNeurons, and
+     * those with new paths to updatedNeurons. */
+    void configure( const std::unordered_set< unsigned int >& preNeuronsWithAllPaths ,
                     const std::unordered_set< unsigned int >& postNeuronsWithAllPaths ,
                     const std::unordered_set< unsigned int >& preNeuronsWithConnectedPaths ,
                     const std::unordered_set< unsigned int >& postNeuronsWithConnectedPaths ,
                     float pointSize ,
-                    std::vector< vec3 >& preOut ,
-                    std::vector< vec3 >& postOut );
-
+                    std::vector< unsigned int >& removedNeurons ,
+                    std::vector< unsigned int >& updatedNeurons );
+
+    /*! Enables spacing path particles by curvature instead of uniformly.
+     * Particles stay dense near branches and synapses. Elsewhere they are
+     * spaced up to a few point sizes apart, while the path stays within a
+     * fraction of the point size of the sampled chords. Since particles
+     * scale with the paths, the error keeps a fixed size on screen relative
+     * to them. Takes effect on the next configure. */
+    void adaptiveSampling( bool state );
+    bool adaptiveSampling( void ) const;
+
+    /*! Tolerance of the section simplification, zero to keep every node.
+     * Takes effect on the next configure. */
+    void simplification( float tolerance );
+    float simplification( void ) const;
+
+    /*! Particles of the configured neurons are looked up in the cache before
+     * computing them, and stored on a miss. Nullptr disables it. */
+    void cache( PathCache* cache_ );
+
+    /*! Builds the trees required by the dynamic paths for the neurons whose
+     * particles came from the cache, and indexes their postsynaptic
+     * synapses. */
+    void prepareDynamicPaths( void );
+
+    /*! Writes the paths of every synapse of the given neurons, processing
+     * them in batches of batchSize neurons. Only one batch is held in memory
+     * at a time. Configured paths are not modified, but they share the
+     * current adaptive sampling setting. progress is called after each batch
+     * with the neurons written so far, and stops the export returning false.
+     * Returns false if the export was stopped. */
+    bool exportPaths( const gidVec& gids , PathChunkWriter& writer ,
+                      float pointSize , unsigned int batchSize ,
+                      const std::function< bool( size_t ) >& progress );
+
+    //! Paths of neuron gid computed by configure, or nullptr.
+    const NeuronPathTask* neuronPaths( unsigned int gid ) const;
+
+    //! Drops every path, so the next configure computes them all again.
     void clear( void );
 
     std::vector< nsolMSection_ptr >
@@ -80,36 +137,31 @@ namespace syncopa
     std::vector< nsolMSection_ptr > pathToSoma( const nsolMSynapse_ptr synapse ,
                                                 TNeuronConnection type = PRESYNAPTIC ) const;
 
-    void addPostsynapticPath( nsolMSynapse_ptr synapse ,
-                              const tPosVec& nodes );
-
-    utils::EventPolylineInterpolation
-    getPostsynapticPath( nsolMSynapse_ptr synapse ) const;
+    /*! Splits the postsynaptic path of synapse into the nodes from the
+     * synapse to the start of its section, and the postsynaptic tree nodes
+     * of the sections from there to the soma, shared with other synapses.
+     * Returns false if the path was not configured or the dynamic paths
+     * were not prepared. */
+    bool postsynapticSections( nsolMSynapse_ptr synapse , tPosVec& head ,
+                               tCNodeVec& sections ) const;
 
     const std::unordered_map< unsigned int , ConnectivityTree >&
     presynapticTrees( void ) const;
 
-    std::pair< unsigned int , cnode_ptr > node( unsigned int sectionID ) const;
-
-    void computedPathFrom( unsigned int sectionID ,
-                           const utils::EventPolylineInterpolation& path );
-
-    utils::EventPolylineInterpolation
-    computeDeepestPathFrom( unsigned originNeuron, ConnectivityNode* origin );
-
     std::vector< vec3 > cutLeafSection( unsigned int sectionID ) const;
 
-    mat4 getTransform( unsigned int gid ) const;
+    const mat4& getTransform( unsigned int gid ) const;
+
+    //! Section paths of the dataset neurons, in world space.
+    const SectionGeometryStore& geometry( void ) const;
 
   protected:
 
     void _calculateSynapses(
-      const std::vector< nsol::SynapsePtr >& synapses ,
       const std::unordered_set< unsigned int >& preNeuronsWithAllPaths ,
       const std::unordered_set< unsigned int >& postNeuronsWithAllPaths ,
       const std::unordered_set< unsigned int >& preNeuronsWithConnectedPaths ,
       const std::unordered_set< unsigned int >& postNeuronsWithConnectedPaths ,
-      tsynapseVec& outUsedSynapses ,
       tsynapseVec& outUsedPreSynapses ,
       tsynapseVec& outUsedPostSynapses ) const;
 
@@ -119,41 +171,69 @@ namespace syncopa
       std::vector< vec3 >& result ,
       nsol::MorphologySynapse* syn ,
       TNeuronConnection type ,
-      float pointSize ) const;
+      const SectionTable* table ,
+      float pointSize ,
+      bool adaptive ,
+      size_t& uniformParticles ) const;
 
-    void _populateTrees( const tsynapseVec& preSynapses,
-                         const tsynapseVec& postSynapses );
+    std::map< unsigned int , NeuronPathTask >
+    _createTasks( const tsynapseVec& preSynapses ,
+                  const tsynapseVec& postSynapses ) const;
 
+    void _removeTask( const NeuronPathTask& task );
 
-    void _processSections( const std::vector< nsolMSynapse_ptr >& preSynapses ,
-                           const std::vector< nsolMSynapse_ptr >& postSynapses );
+    //! Runs the configuration stages, sampling the particles if requested.
+    void _processTasks( const std::vector< NeuronPathTask* >& pending ,
+                        bool sample );
 
-    void
-    _processEndSections( const std::vector< nsolMSynapse_ptr >& preSynapses ,
-                         const std::vector< nsolMSynapse_ptr >& postSynapses );
+    QString _cacheKey( const NeuronPathTask& task ) const;
 
-    unsigned int findSynapseSegment( const vec3& synapsePos ,
-                                     const nsol::Nodes& nodes ) const;
+    void _populateTrees( NeuronPathTask& task );
+
+    void _processSections( NeuronPathTask& task );
 
+    void _processEndSections( NeuronPathTask& task );
 
-    std::vector< vec3 > _cutEndSection( const std::vector< vec3 >& nodes ,
-                                        const vec3& synapsePos ,
-                                        unsigned int index ) const;
+    void _createPaths( NeuronPathTask& task , float pointSize ,
+                       bool adaptive ) const;
+
+    //! Nodes from a postsynaptic synapse back to the start of its section.
+    static void _postsynapticHead( const SectionSynapse& sectionSynapse ,
+                                   const utils::PolylineInterpolation& sectionPath ,
+                                   tPosVec& points );
+
+    unsigned int findSynapseSegment( const vec3& synapsePos ,
+                                     const nsol::Nodes& nodes ) const;
 
     nsol::DataSet* _dataset;
 
     const TSynapseInfo* _synapseFixInfo;
 
+    const SynapseIndex* _synapseIndex;
+
+    SectionGeometryStore _geometry;
+
+    PathCache* _cache;
+
     std::unordered_map< unsigned int , ConnectivityTree > _treePre;
     std::unordered_map< unsigned int , ConnectivityTree > _treePost;
 
-    tSectionsInfoMap _infoSections;
+    //! Processed sections of each neuron.
+    std::unordered_map< unsigned int , SectionTable > _sectionTables;
 
-    std::unordered_map< nsolMSynapse_ptr , utils::PolylineInterpolation > _pathsPre;
-    std::unordered_map< nsolMSynapse_ptr , utils::PolylineInterpolation > _pathsPost;
 
     std::unordered_set< nsolMSynapse_ptr > _somaSynapses;
 
+    //! Neurons with paths, kept between configure calls.
+    std::map< unsigned int , NeuronPathTask > _neuronTasks;
+    float _pointSize;
+
+    float _simplification;
+
+    bool _adaptiveSampling;
+    //! Sampling mode of the paths in _neuronTasks.
+    bool _sampledAdaptive;
+
     unsigned int _maxDepth;
   };
 }
@@ -13,8 +13,11 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <memory>
 
 #include <algorithm>
+#include <cmath>
 
 #include <iostream>
 
@@ -22,24 +25,44 @@
 
 namespace utils
 {
+  //! Node storage of a polyline, shared between copies until modified.
+  struct PolylineData
+  {
+    std::vector< float > distances;
+    std::vector< vec3 > positions;
+    std::vector< vec3 > directions;
+  };
+
+  /*! Polyline with accumulated distances and segment directions.
+   * Copies share the same immutable node storage, so passing polylines
+   * around by value is O(1). The storage is only duplicated when a shared
+   * polyline is modified (copy on write). */
   class PolylineInterpolation
   {
   public:
 
     PolylineInterpolation( void )
-    : _size( 0 )
+    : _data( _emptyData( ))
+    , _size( 0 )
     { }
 
     PolylineInterpolation( const std::vector< vec3 >& nodes )
-    : _size( 0 )
+    : _data( std::make_shared< PolylineData >( ))
+    , _size( 0 )
     {
-      _distances.reserve( nodes.size( ));
-      _positions.reserve( nodes.size( ));
-      _directions.reserve( nodes.size( ));
+      _data->distances.reserve( nodes.size( ));
+      _data->positions.reserve( nodes.size( ));
+      _data->directions.reserve( nodes.size( ));
 
       insert( nodes );
     }
 
+    //! Takes already computed node data, without validating it.
+    explicit PolylineInterpolation( PolylineData&& data )
+    : _data( std::make_shared< PolylineData >( std::move( data )))
+    , _size( static_cast< unsigned int >( _data->distances.size( )))
+    { }
+
     virtual ~PolylineInterpolation( void )
     { }
 
@@ -47,22 +70,34 @@ namespace utils
     {
       if(other.empty()) return;
 
-      const unsigned int totalSize = _size + other.size( );
-      const float offsetDistance = totalDistance( );
-      const unsigned int offsetIndex = _size;
+      // Joining onto an empty polyline only shares the other storage.
+      if( _size == 0 )
+      {
+        _data = other._data;
+        _size = other._size;
+        return;
+      }
 
       insert( other.firstPosition( ));
 
-      _positions.resize( totalSize );
-      _distances.resize( totalSize );
-      _directions.resize( totalSize );
+      const unsigned int offsetIndex = _size - 1;
+      const unsigned int totalSize =
+        offsetIndex + static_cast< unsigned int >( other.size( ));
+      const float offsetDistance = totalDistance( );
+
+      PolylineData& data = _mutableData( );
+      data.positions.resize( totalSize );
+      data.distances.resize( totalSize );
+      data.directions.resize( totalSize );
 
       for( unsigned int i = 1; i < other.size( ); ++i )
       {
-        _positions[ offsetIndex + i ] = other._positions[ i ];
-        _directions[ offsetIndex + i ] = other._directions[ i ];
-        _distances[ offsetIndex + i ] = other._distances[ i ] + offsetDistance;
+        data.positions[ offsetIndex + i ] = other._data->positions[ i ];
+        data.directions[ offsetIndex + i ] = other._data->directions[ i ];
+        data.distances[ offsetIndex + i ] = other._data->distances[ i ] + offsetDistance;
       }
+
+      _size = totalSize;
     }
 
     virtual void insert( const std::vector< vec3 >& nodes )
@@ -76,7 +111,7 @@ namespace utils
 
       insert( nodes.front( ));
 
-      accDist = _distances.back( );
+      accDist = _data->distances.back( );
 
       for( unsigned int i = 0; i < nodes.size( ) - 1; ++i )
       {
@@ -100,8 +135,8 @@ namespace utils
       }
       else
       {
-        const vec3 prevPoint = _positions.back( );
-        float accDist = _distances.back( );
+        const vec3 prevPoint = _data->positions.back( );
+        float accDist = _data->distances.back( );
 
         vec3 dir = node - prevPoint;
         const float module = dir.norm( );
@@ -114,40 +149,40 @@ namespace utils
 
     virtual inline unsigned int insert( float distance, vec3 position, vec3 direction )
     {
-      if( !_positions.empty( ) && position == _positions.back( ))
+      if( !_data->positions.empty( ) && position == _data->positions.back( ))
         return _size;
 
+      PolylineData& data = _mutableData( );
+
       // New highest position
-      _distances.push_back( distance );
-      _positions.push_back( position );
-      _directions.push_back( direction );
+      data.distances.push_back( distance );
+      data.positions.push_back( position );
+      data.directions.push_back( direction );
 
-      _size = static_cast<unsigned int>(_distances.size());
+      _size = static_cast<unsigned int>(data.distances.size());
 
       return _size - 1;
     }
 
     inline void clear()
     {
-      _distances.clear();
-      _positions.clear();
-      _directions.clear();
+      _data = _emptyData( );
       _size = 0;
     }
 
     inline const vec3& firstPosition() const
     {
-      return _positions[0];
+      return _data->positions[0];
     }
 
     const vec3& lastPosition( ) const
     {
-      return _positions.back( );
+      return _data->positions.back( );
     }
 
     const std::vector< vec3 >& positions( void ) const
     {
-      return _positions;
+      return _data->positions;
     }
 
     bool empty( void ) const
@@ -163,29 +198,29 @@ namespace utils
     vec3 operator[]( unsigned int i ) const
     {
       assert( i < _size );
-      return _positions[ i ];
+      return _data->positions[ i ];
     }
 
     vec3 direction( unsigned int i ) const
     {
-      return _directions[ i ];
+      return _data->directions[ i ];
     }
 
     vec3 segmentDirection( unsigned int i ) const
     {
       assert( i < _size - 1);
-      return _directions[ i + 1 ];
+      return _data->directions[ i + 1 ];
     }
 
     vec3 lastSegmentDirection( void ) const
     {
-      return _directions.back( );
+      return _data->directions.back( );
     }
 
     float distance( unsigned int i ) const
     {
       assert( i < _size );
-      return _distances[ i ];
+      return _data->distances[ i ];
     }
 
     float totalDistance( void ) const
@@ -193,26 +228,26 @@ namespace utils
       if( _size == 0 )
         return 0.0f;
 
-      return _distances.back( );
+      return _data->distances.back( );
     }
 
     float segmentDistance( unsigned int i ) const
     {
       if( i < _size - 1)
-        return _distances[ i + 1 ] - _distances[ i ];
+        return _data->distances[ i + 1 ] - _data->distances[ i ];
       else
         return 0;
     }
 
     float firstSegmentDistance( void ) const
     {
-      assert( _distances.size( ) > 1 );
-      return _distances[ 1 ];
+      assert( _data->distances.size( ) > 1 );
+      return _data->distances[ 1 ];
     }
 
     float lastSegmentDistance( void ) const
     {
-      return _distances[ _size - 1 ] - _distances[ _size - 2 ];
+      return _data->distances[ _size - 1 ] - _data->distances[ _size - 2 ];
     }
 
     // Faster implementation for CPU interpolation.
@@ -225,7 +260,7 @@ namespace utils
       }
       else
       {
-        return _positions[ 0 ];
+        return _data->positions[ 0 ];
       }
     }
 
@@ -235,37 +270,154 @@ namespace utils
       if( segmentIdx >= _size )
         segmentIdx = _size -1;
 
-      const float accumulated = distance - _distances[ segmentIdx ];
-      const vec3 dir = _directions[ segmentIdx + 1 ];
-      const vec3 res = _positions[ segmentIdx ] + dir * accumulated;
+      const float accumulated = distance - _data->distances[ segmentIdx ];
+      const vec3 dir = _data->directions[ segmentIdx + 1 ];
+      const vec3 res = _data->positions[ segmentIdx ] + dir * accumulated;
 
       return res;
     }
 
-    std::vector< vec3 > interpolate( float stepSize,
-                                     std::function< vec3 ( vec3 ) > operation )
+    //! Number of points placed by sampleUniform for the given step.
+    unsigned int sampleCount( float step ) const
+    {
+      if( _size == 0 || step <= 0.0f )
+        return 0;
+
+      return static_cast< unsigned int >(
+        std::ceil( totalDistance( ) / step ));
+    }
+
+    /*! Writes the points at distances 0, step, 2 * step... below the total
+     * distance into outBuffer, which must hold sampleCount( step ) elements.
+     * Points are generated segment by segment, each run of samples being a
+     * single vectorized lerp over the segment. */
+    unsigned int sampleUniform( float step, vec3* outBuffer ) const
     {
-      float currentDist = 0;
-      std::vector< vec3 > result;
+      const unsigned int count = sampleCount( step );
+      if( count == 0 )
+        return 0;
+
+      outBuffer[ 0 ] = _data->positions[ 0 ];
 
-      while( currentDist < _distances.back( ))
+      unsigned int first = 1;
+      for( unsigned int segment = 0; segment + 1 < _size && first < count;
+           ++segment )
       {
-        const vec3 pos = pointAtDistance( currentDist );
+        unsigned int last = count;
+        if( segment + 2 < _size )
+        {
+          last = std::min( count, static_cast< unsigned int >(
+            std::floor( _data->distances[ segment + 1 ] / step )) + 1 );
+        }
+
+        if( last <= first )
+          continue;
+
+        const unsigned int samples = last - first;
+        const float start = _data->distances[ segment ];
 
-        result.push_back( operation( pos ));
+        Eigen::Map< Eigen::Matrix3Xf > block( outBuffer[ first ].data( ),
+                                              3, samples );
+        block.noalias( ) = _data->directions[ segment + 1 ] *
+          ( Eigen::RowVectorXf::LinSpaced(
+              samples, static_cast< float >( first ),
+              static_cast< float >( last - 1 )).array( ) * step - start )
+          .matrix( );
+        block.colwise( ) += _data->positions[ segment ];
 
-        currentDist += stepSize;
+        first = last;
       }
 
-      return result;
+      return count;
+    }
+
+    //! Appends the sampleUniform points to result with a single resize.
+    void sampleUniform( float step, std::vector< vec3 >& result ) const
+    {
+      const size_t offset = result.size( );
+      result.resize( offset + sampleCount( step ));
+
+      if( result.size( ) > offset )
+        sampleUniform( step, result.data( ) + offset );
+    }
+
+    //! Points every stepSize along the path, walked with a PolylineCursor.
+    std::vector< vec3 > interpolate( float stepSize,
+                                     std::function< vec3 ( vec3 ) > operation ) const;
+
+    /*! Largest distance from the nodes between both distances to the chord
+     * joining the points at those distances. */
+    float chordError( float from, float to ) const
+    {
+      if( _size < 3 || to <= from )
+        return 0.0f;
+
+      const vec3 start = pointAtDistance( from );
+      const vec3 chord = pointAtDistance( to ) - start;
+      const float length = chord.norm( );
+
+      float error = 0.0f;
+      for( unsigned int i = segmentFromDistance( from ) + 1;
+           i < _size && _data->distances[ i ] < to; ++i )
+      {
+        const vec3 offset = _data->positions[ i ] - start;
+        error = std::max( error, length > 0.0f ?
+                          offset.cross( chord ).norm( ) / length :
+                          offset.norm( ));
+      }
+
+      return error;
+    }
+
+    /*! Appends points spaced between minStep and maxStep to result. Spacing
+     * is minStep within anchorRange of both ends and of the given sorted
+     * anchor distances. Elsewhere it is halved from maxStep until the
+     * polyline stays within tolerance of the chord between samples. */
+    void sampleAdaptive( float minStep, float maxStep, float tolerance,
+                         const std::vector< float >& anchors,
+                         float anchorRange,
+                         std::vector< vec3 >& result ) const
+    {
+      if( _size == 0 || minStep <= 0.0f )
+        return;
+
+      const float total = totalDistance( );
+      auto anchor = anchors.begin( );
+
+      float current = 0.0f;
+      while( current < total )
+      {
+        result.push_back( pointAtDistance( current ));
+
+        while( anchor != anchors.end( ) && *anchor + anchorRange < current )
+          ++anchor;
+
+        // Next point where dense sampling starts again.
+        float denseStart = total - anchorRange;
+        if( anchor != anchors.end( ))
+          denseStart = std::min( denseStart, *anchor - anchorRange );
+
+        float step = minStep;
+        if( current >= anchorRange && current < denseStart )
+        {
+          step = std::max( minStep, std::min( maxStep, denseStart - current ));
+
+          while( step > minStep &&
+                 chordError( current, std::min( current + step, total )) >
+                 tolerance )
+            step = std::max( minStep, step * 0.5f );
+        }
+
+        current += step;
+      }
     }
 
     void reverse( void )
     {
       std::vector< vec3 > reversePositions;
-      reversePositions.reserve( _positions.size( ));
+      reversePositions.reserve( _data->positions.size( ));
 
-      for( auto it = _positions.rbegin( ); it != _positions.rend( ); ++it )
+      for( auto it = _data->positions.rbegin( ); it != _data->positions.rend( ); ++it )
       {
         reversePositions.push_back( *it );
       }
@@ -287,112 +439,100 @@ namespace utils
 
     unsigned int segmentFromDistance( float distance ) const
     {
-      if( _distances.empty( ) || distance > _distances.back( ))
+      if( _data->distances.empty( ) || distance > _data->distances.back( ))
         return _size;
 
-      unsigned int i = 0;
-      while( distance > _distances[ i + 1 ])
-      {
-        ++i;
-      }
+      // First segment whose end distance is not below the given one.
+      const auto it = std::lower_bound( _data->distances.begin( ) + 1,
+                                        _data->distances.end( ), distance );
 
-      return i;
+      return static_cast< unsigned int >( it - _data->distances.begin( ) - 1 );
     }
 
   protected:
-    std::vector< float > _distances;
-    std::vector< vec3 > _positions;
-    std::vector< vec3 > _directions;
 
-    unsigned int _size;
-  };
+    static const std::shared_ptr< PolylineData >& _emptyData( void )
+    {
+      static const std::shared_ptr< PolylineData > empty =
+        std::make_shared< PolylineData >( );
 
-  enum tEventType
-  {
-    TEvent_section = 0,
-    TEvent_synapse
-  };
+      return empty;
+    }
+
+    //! Storage owned only by this polyline, duplicated first if shared.
+    PolylineData& _mutableData( void )
+    {
+      if( _data.use_count( ) > 1 )
+        _data = std::make_shared< PolylineData >( *_data );
+
+      return *_data;
+    }
+
+    std::shared_ptr< PolylineData > _data;
 
-  typedef std::tuple< float, unsigned long int, unsigned int > tEventSectionInfo;
-  typedef std::vector< tEventSectionInfo > tSectionEvents;
+    unsigned int _size;
+  };
 
-  class EventPolylineInterpolation : public PolylineInterpolation
+  /*! Forward-only sampler over a polyline. Keeps the current segment between
+   * calls so that walking a path with non-decreasing distances costs linear
+   * time overall instead of one segment search per sample. */
+  class PolylineCursor
   {
   public:
 
-    EventPolylineInterpolation( )
-    : PolylineInterpolation( )
+    PolylineCursor( const PolylineInterpolation& polyline )
+    : _polyline( polyline )
+    , _segment( 0 )
     { }
 
-    EventPolylineInterpolation( const tPosVec& nodes )
-    : PolylineInterpolation( nodes )
-    { }
+    inline vec3 pointAtDistance( float distance )
+    {
+      const unsigned int size =
+        static_cast< unsigned int >( _polyline.size( ));
 
-    EventPolylineInterpolation( const PolylineInterpolation& other )
-    : PolylineInterpolation( other )
-    { }
+      if( size < 2 || distance <= 0.0f )
+        return _polyline[ 0 ];
 
-    virtual void insert( const std::vector< vec3 >& nodes )
-    {
-      PolylineInterpolation::insert( nodes );
+      while( _segment + 2 < size &&
+             distance > _polyline.distance( _segment + 1 ))
+      {
+        ++_segment;
+      }
+
+      return _polyline.pointAtDistance( distance, _segment );
     }
 
-    virtual void insert( const vec3 node )
+    unsigned int segment( void ) const
     {
-      PolylineInterpolation::insert( node );
+      return _segment;
     }
 
-    void addEventNode( float distance, unsigned long int eventID, tEventType type = TEvent_section )
+    void reset( void )
     {
-      _events.push_back( std::make_tuple( distance, eventID, static_cast<int>(type) ));
-//      unsigned int pos = _segmentFromDistance( distance );
-//
-//      if( pos >= _size - 1 )
-//        return;
-//
-//      assert( _eventSection.size( ) == _size );
-//
-//      _eventSection[ pos ].push_back( std::make_pair( distance, eventID ));
-
-//      std::cout << "--Added event for " << eventID
-//                << " at " << pos
-//                << " with dist " << distance
-//                << std::endl;
-//
-//      std::cout << "Events: " << _distances[ pos ] << "-" << _distances[ pos + 1 ];
-//      for( auto event : _eventSection[ pos ] )
-//      {
-//        std::cout << " " << event.first << "->" << event.second;
-//      }
-//      std::cout << std::endl;
-
+      _segment = 0;
     }
 
-    tSectionEvents eventsAt( float distance, float step ) const
-    {
-      tSectionEvents result;
+  protected:
 
-      const float prevDist = std::max( 0.0f, distance - step );
-      const unsigned int i = segmentFromDistance( prevDist );
+    const PolylineInterpolation& _polyline;
 
-      if( i >= _size )
-        return result;
+    unsigned int _segment;
+  };
 
-      for( auto event : _events )
-      {
-        const float eventDistance = std::get< 0 >( event );
-        if( eventDistance >= prevDist && eventDistance < distance )
-        {
-          result.push_back( event );
-        }
-      }
+  inline std::vector< vec3 > PolylineInterpolation::interpolate(
+    float stepSize, std::function< vec3 ( vec3 ) > operation ) const
+  {
+    std::vector< vec3 > result;
+    PolylineCursor cursor( *this );
 
-      return result;
+    for( float currentDist = 0; currentDist < totalDistance( );
+         currentDist += stepSize )
+    {
+      result.push_back( operation( cursor.pointAtDistance( currentDist )));
     }
 
-  protected:
-    tSectionEvents _events;
-  };
+    return result;
+  }
 }
 
 #endif /* POLYLINEINTERPOLATION_H_ */
@@ -0,0 +1,443 @@
+/*
+ * @file  SectionGeometryStore.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+
+#include "SectionGeometryStore.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace syncopa
+{
+  const unsigned int SectionGeometryStore::invalidIndex =
+    std::numeric_limits< unsigned int >::max( );
+
+  SectionGeometryStore::SectionGeometryStore( void )
+    : _dataset( nullptr )
+    , _tolerance( 0.0f )
+    , _firstGid( 0 )
+  { }
+
+  SectionGeometryStore::~SectionGeometryStore( void )
+  {
+
+  }
+
+  void SectionGeometryStore::build( nsol::DataSet* dataset , float tolerance )
+  {
+    clear( );
+
+    _dataset = dataset;
+    _tolerance = tolerance;
+    if ( !_dataset )
+      return;
+
+    const auto& neurons = _dataset->neurons( );
+    if ( neurons.empty( ))
+      return;
+
+    unsigned int lastGid = 0;
+    _firstGid = std::numeric_limits< unsigned int >::max( );
+    for ( const auto& neuron: neurons )
+    {
+      _firstGid = std::min( _firstGid , neuron.first );
+      lastGid = std::max( lastGid , neuron.first );
+    }
+
+    _neuronIndices.assign( lastGid - _firstGid + 1 , invalidIndex );
+    _transforms.reserve( neurons.size( ));
+    _neuronMorphologies.reserve( neurons.size( ));
+
+    std::vector< std::pair< nsol::NeuronMorphologyPtr ,
+      MorphologyGeometry* >> pending;
+
+    for ( const auto& neuron: neurons )
+    {
+      auto morphology = neuron.second->morphology( );
+
+      const MorphologyGeometry* geometry = nullptr;
+      if ( morphology )
+      {
+        auto it = _morphologies.find( morphology );
+        if ( it == _morphologies.end( ))
+        {
+          it = _morphologies.insert( std::make_pair(
+            morphology , MorphologyGeometry( ))).first;
+          pending.emplace_back( morphology , &it->second );
+        }
+        geometry = &it->second;
+      }
+
+      _neuronIndices[ neuron.first - _firstGid ] =
+        static_cast< unsigned int >( _transforms.size( ));
+      _transforms.push_back( neuron.second->transform( ));
+      _neuronMorphologies.push_back( geometry );
+    }
+
+    _neurons.resize( _transforms.size( ));
+
+#pragma omp parallel for schedule(dynamic)
+    for ( int i = 0; i < static_cast< int >( pending.size( )); ++i )
+      _flatten( pending[ i ].first , *pending[ i ].second );
+  }
+
+  void SectionGeometryStore::clear( void )
+  {
+    std::lock_guard< std::mutex > lock( _neuronsMutex );
+
+    _neurons.clear( );
+    _morphologies.clear( );
+    _neuronIndices.clear( );
+    _transforms.clear( );
+    _neuronMorphologies.clear( );
+    _firstGid = 0;
+    _dataset = nullptr;
+  }
+
+  void SectionGeometryStore::release( unsigned int gid )
+  {
+    const auto index = neuronIndex( gid );
+    if ( index == invalidIndex )
+      return;
+
+    std::lock_guard< std::mutex > lock( _neuronsMutex );
+    _neurons[ index ].reset( );
+  }
+
+  float SectionGeometryStore::tolerance( void ) const
+  {
+    return _tolerance;
+  }
+
+  const utils::PolylineInterpolation&
+  SectionGeometryStore::section( unsigned int gid ,
+                                 nsolMSection_ptr section ) const
+  {
+    static const utils::PolylineInterpolation emptySection;
+
+    const auto neuron = neuronIndex( gid );
+    if ( neuron == invalidIndex || !_neuronMorphologies[ neuron ] )
+      return emptySection;
+
+    const auto morphology = _neuronMorphologies[ neuron ];
+    auto index = morphology->sectionIndices.find( section );
+    if ( index == morphology->sectionIndices.end( ))
+      return emptySection;
+
+    const auto sections = _neuronSections( neuron );
+    if ( !sections )
+      return emptySection;
+
+    return ( *sections )[ index->second ];
+  }
+
+  float SectionGeometryStore::sectionLength( unsigned int gid ,
+                                             nsolMSection_ptr section ) const
+  {
+    const auto morphology = _morphology( gid );
+    if ( !morphology )
+      return 0.0f;
+
+    auto index = morphology->sectionIndices.find( section );
+    if ( index == morphology->sectionIndices.end( ))
+      return 0.0f;
+
+    const auto& range = morphology->sections[ index->second ];
+    if ( range.size == 0 )
+      return 0.0f;
+
+    return morphology->distances[ range.offset + range.size - 1 ];
+  }
+
+  unsigned int SectionGeometryStore::segment( unsigned int gid ,
+                                              nsolMSection_ptr section ,
+                                              unsigned int sourceSegment ,
+                                              float& segmentDistance ) const
+  {
+    const auto morphology = _morphology( gid );
+    if ( !morphology )
+      return invalidIndex;
+
+    auto index = morphology->sectionIndices.find( section );
+    if ( index == morphology->sectionIndices.end( ))
+      return invalidIndex;
+
+    const auto& range = morphology->sections[ index->second ];
+    const auto& source = morphology->sourceSections[ index->second ];
+    if ( range.size < 2 || sourceSegment + 1 >= source.size )
+      return invalidIndex;
+
+    const auto segment = morphology->sourceSegments[ source.offset +
+                                                     sourceSegment ];
+
+    // Position of the point inside the span of nsol nodes replaced by the
+    // stored segment, kept as a fraction of its length.
+    const auto first = range.offset + segment;
+    const auto sourceStart = morphology->sourceDistances[
+      source.offset + morphology->sourceNodes[ first ]];
+    const auto sourceEnd = morphology->sourceDistances[
+      source.offset + morphology->sourceNodes[ first + 1 ]];
+
+    const auto length = morphology->distances[ first + 1 ] -
+                        morphology->distances[ first ];
+
+    if ( sourceEnd > sourceStart )
+    {
+      const auto sourceDistance =
+        morphology->sourceDistances[ source.offset + sourceSegment ] +
+        segmentDistance;
+      segmentDistance = length * ( sourceDistance - sourceStart ) /
+                        ( sourceEnd - sourceStart );
+    }
+
+    segmentDistance = std::max( 0.0f , std::min( length , segmentDistance ));
+
+    return segment;
+  }
+
+  unsigned int SectionGeometryStore::neuronIndex( unsigned int gid ) const
+  {
+    if ( gid < _firstGid || gid - _firstGid >= _neuronIndices.size( ))
+      return invalidIndex;
+
+    return _neuronIndices[ gid - _firstGid ];
+  }
+
+  const mat4& SectionGeometryStore::transform( unsigned int gid ) const
+  {
+    static const mat4 identity = mat4::Identity( );
+
+    const auto index = neuronIndex( gid );
+    if ( index == invalidIndex )
+      return identity;
+
+    return _transforms[ index ];
+  }
+
+  const MorphologyGeometry*
+  SectionGeometryStore::_morphology( unsigned int gid ) const
+  {
+    const auto index = neuronIndex( gid );
+    if ( index == invalidIndex )
+      return nullptr;
+
+    return _neuronMorphologies[ index ];
+  }
+
+  const SectionGeometryStore::tNeuronSections*
+  SectionGeometryStore::_neuronSections( unsigned int index ) const
+  {
+    {
+      std::lock_guard< std::mutex > lock( _neuronsMutex );
+
+      if ( _neurons[ index ] )
+        return _neurons[ index ].get( );
+    }
+
+    // Transformed out of the lock. If two threads race for the same neuron
+    // the first result stored is kept.
+    auto sections = _transform( *_neuronMorphologies[ index ] ,
+                                _transforms[ index ] );
+
+    std::lock_guard< std::mutex > lock( _neuronsMutex );
+
+    if ( !_neurons[ index ] )
+      _neurons[ index ] = std::move( sections );
+
+    return _neurons[ index ].get( );
+  }
+
+  void SectionGeometryStore::_flatten( nsol::NeuronMorphologyPtr morphology ,
+                                       MorphologyGeometry& geometry ) const
+  {
+    std::vector< vec3 > points;
+    std::vector< bool > keep;
+
+    for ( auto neurite: morphology->neurites( ))
+    {
+      for ( auto sectionBase: neurite->sections( ))
+      {
+        auto section = dynamic_cast< nsolMSection_ptr >( sectionBase );
+        if ( !section ||
+             geometry.sectionIndices.find( section ) !=
+             geometry.sectionIndices.end( ))
+          continue;
+
+        points.clear( );
+        for ( auto node: section->nodes( ))
+          points.push_back( node->point( ));
+
+        SectionGeometryRange source;
+        source.offset = static_cast< unsigned int >(
+          geometry.sourceDistances.size( ));
+        source.size = static_cast< unsigned int >( points.size( ));
+
+        // Repeated nodes are discarded exactly as when inserting them one
+        // by one in a polyline.
+        keep.assign( points.size( ) , true );
+        float accumulated = 0.0f;
+        for ( unsigned int i = 0; i < points.size( ); ++i )
+        {
+          if ( i > 0 )
+          {
+            accumulated += ( points[ i ] - points[ i - 1 ] ).norm( );
+            keep[ i ] = points[ i ] != points[ i - 1 ];
+          }
+          geometry.sourceDistances.push_back( accumulated );
+        }
+
+        if ( _tolerance > 0.0f )
+          _simplify( points , keep );
+
+        utils::PolylineInterpolation path;
+        std::vector< unsigned int > sourceNodes;
+        for ( unsigned int i = 0; i < points.size( ); ++i )
+        {
+          if ( !keep[ i ] )
+            continue;
+
+          // Simplification may leave equal points next to each other,
+          // and the polyline drops the second one.
+          const auto size = path.size( );
+          path.insert( points[ i ] );
+          if ( path.size( ) > size )
+            sourceNodes.push_back( i );
+        }
+
+        SectionGeometryRange range;
+        range.offset = static_cast< unsigned int >( geometry.positions.size( ));
+        range.size = static_cast< unsigned int >( path.size( ));
+
+        for ( unsigned int i = 0; i < range.size; ++i )
+        {
+          geometry.positions.push_back( path[ i ] );
+          geometry.directions.push_back( path.direction( i ));
+          geometry.distances.push_back( path.distance( i ));
+          geometry.sourceNodes.push_back( sourceNodes[ i ] );
+        }
+
+        // Stored segment holding each nsol node, the last one closing the
+        // last segment.
+        unsigned int segment = 0;
+        for ( unsigned int i = 0; i < source.size; ++i )
+        {
+          while ( segment + 2 < range.size && sourceNodes[ segment + 1 ] <= i )
+            ++segment;
+          geometry.sourceSegments.push_back( segment );
+        }
+
+        geometry.sectionIndices.insert( std::make_pair(
+          section , static_cast< unsigned int >( geometry.sections.size( ))));
+        geometry.sections.push_back( range );
+        geometry.sourceSections.push_back( source );
+      }
+    }
+  }
+
+  void SectionGeometryStore::_simplify( const std::vector< vec3 >& points ,
+                                        std::vector< bool >& keep ) const
+  {
+    // Only nodes still kept take part, so that both ends of every span are
+    // nodes of the final path.
+    std::vector< unsigned int > nodes;
+    for ( unsigned int i = 0; i < points.size( ); ++i )
+      if ( keep[ i ] )
+        nodes.push_back( i );
+
+    if ( nodes.size( ) < 3 )
+      return;
+
+    std::vector< std::pair< unsigned int , unsigned int >> pending;
+    pending.emplace_back( 0 , static_cast< unsigned int >( nodes.size( )) - 1 );
+
+    while ( !pending.empty( ))
+    {
+      const auto first = pending.back( ).first;
+      const auto last = pending.back( ).second;
+      pending.pop_back( );
+
+      const vec3& start = points[ nodes[ first ]];
+      const vec3 chord = points[ nodes[ last ]] - start;
+      const float squaredLength = chord.squaredNorm( );
+
+      float farthestDistance = 0.0f;
+      unsigned int farthest = first;
+      for ( unsigned int i = first + 1; i < last; ++i )
+      {
+        // Distance to the chord segment, so that nodes going back along
+        // the chord line are not dropped.
+        const vec3 offset = points[ nodes[ i ]] - start;
+        const float projection = squaredLength > 0.0f ?
+          std::min( std::max( offset.dot( chord ) / squaredLength , 0.0f ) ,
+                    1.0f ) : 0.0f;
+        const float distance = ( offset - projection * chord ).norm( );
+        if ( distance > farthestDistance )
+        {
+          farthestDistance = distance;
+          farthest = i;
+        }
+      }
+
+      if ( farthestDistance > _tolerance )
+      {
+        pending.emplace_back( first , farthest );
+        pending.emplace_back( farthest , last );
+      }
+      else
+      {
+        for ( unsigned int i = first + 1; i < last; ++i )
+          keep[ nodes[ i ]] = false;
+      }
+    }
+  }
+
+  std::unique_ptr< SectionGeometryStore::tNeuronSections >
+  SectionGeometryStore::_transform( const MorphologyGeometry& geometry ,
+                                    const mat4& transform ) const
+  {
+    const auto count = static_cast< Eigen::Index >( geometry.positions.size( ));
+
+    const Eigen::Map< const Eigen::Matrix3Xf > localPositions(
+      geometry.positions.empty( ) ? nullptr : geometry.positions.front( ).data( ) ,
+      3 , count );
+    const Eigen::Map< const Eigen::Matrix3Xf > localDirections(
+      geometry.directions.empty( ) ? nullptr : geometry.directions.front( ).data( ) ,
+      3 , count );
+
+    const Eigen::Matrix3f rotation = transform.block< 3 , 3 >( 0 , 0 );
+    const vec3 translation = transform.block< 3 , 1 >( 0 , 3 );
+
+    const Eigen::Matrix3Xf positions =
+      ( rotation * localPositions ).colwise( ) + translation;
+    const Eigen::Matrix3Xf directions = rotation * localDirections;
+
+    std::unique_ptr< tNeuronSections > result( new tNeuronSections( ));
+    result->reserve( geometry.sections.size( ));
+
+    for ( const auto& range: geometry.sections )
+    {
+      utils::PolylineData data;
+      data.positions.reserve( range.size );
+      data.directions.reserve( range.size );
+
+      for ( unsigned int i = range.offset; i < range.offset + range.size; ++i )
+      {
+        data.positions.emplace_back( positions.col( i ));
+        data.directions.emplace_back( directions.col( i ));
+      }
+
+      data.distances.assign( geometry.distances.begin( ) + range.offset ,
+                             geometry.distances.begin( ) + range.offset +
+                             range.size );
+
+      result->emplace_back( std::move( data ));
+    }
+
+    return result;
+  }
+}
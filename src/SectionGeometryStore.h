@@ -0,0 +1,145 @@
+/*
+ * @file  SectionGeometryStore.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#ifndef SRC_SECTIONGEOMETRYSTORE_H_
+#define SRC_SECTIONGEOMETRYSTORE_H_
+
+#include "types.h"
+
+#include <memory>
+#include <mutex>
+
+#include <nsol/nsol.h>
+
+#include "PolylineInterpolation.hpp"
+
+namespace syncopa
+{
+  //! Nodes of a section inside the flattened arrays of its morphology.
+  struct SectionGeometryRange
+  {
+    unsigned int offset;
+    unsigned int size;
+  };
+
+  /*! Node geometry of every section of a morphology, in local coordinates.
+   * Nodes of all sections are stored contiguously, together with the
+   * accumulated distance of each node along its own section. */
+  struct MorphologyGeometry
+  {
+    std::vector< vec3 > positions;
+    std::vector< vec3 > directions;
+    std::vector< float > distances;
+
+    std::vector< SectionGeometryRange > sections;
+    std::unordered_map< nsolMSection_ptr , unsigned int > sectionIndices;
+
+    //! Node of the nsol section each stored node comes from.
+    std::vector< unsigned int > sourceNodes;
+
+    /*! For every nsol section node, its accumulated distance and the stored
+     * segment holding it, in ranges parallel to sections. */
+    std::vector< SectionGeometryRange > sourceSections;
+    std::vector< float > sourceDistances;
+    std::vector< unsigned int > sourceSegments;
+  };
+
+  /*! Section paths of the loaded neurons. Morphologies are flattened once
+   * when the dataset is loaded and shared by all the neurons using them.
+   * Paths in the space of a given neuron are computed the first time that
+   * neuron is requested and cached afterwards. Neuron transforms are
+   * expected to be rigid, so accumulated distances are reused as they are.
+   * Neurons are addressed by a compact index, used to look up their
+   * transform and morphology in dense tables.
+   */
+  class SectionGeometryStore
+  {
+  public:
+
+    static const unsigned int invalidIndex;
+
+    SectionGeometryStore( void );
+
+    ~SectionGeometryStore( void );
+
+    /*! Morphologies must not be modified after building the store. With a
+     * positive tolerance, sections are simplified so that no removed node
+     * lies farther than tolerance from the stored path. */
+    void build( nsol::DataSet* dataset , float tolerance = 0.0f );
+
+    float tolerance( void ) const;
+
+    void clear( void );
+
+    //! Drops the cached sections of neuron gid, computed again on request.
+    void release( unsigned int gid );
+
+    /*! Path of the given section in the space of neuron gid. Returns an
+     * empty path for unknown neurons or sections. Thread safe. */
+    const utils::PolylineInterpolation&
+    section( unsigned int gid , nsolMSection_ptr section ) const;
+
+    //! Length of the section, without transforming the neuron.
+    float sectionLength( unsigned int gid , nsolMSection_ptr section ) const;
+
+    /*! Stored segment holding a point given on the nsol section by its
+     * segment index and its distance along that segment. segmentDistance
+     * is updated to the distance along the returned segment. Returns
+     * invalidIndex for unknown neurons, sections or segments. */
+    unsigned int segment( unsigned int gid , nsolMSection_ptr section ,
+                          unsigned int sourceSegment ,
+                          float& segmentDistance ) const;
+
+    //! Compact index of neuron gid, or invalidIndex.
+    unsigned int neuronIndex( unsigned int gid ) const;
+
+    //! Transform of neuron gid, identity for unknown neurons.
+    const mat4& transform( unsigned int gid ) const;
+
+  protected:
+
+    typedef std::vector< utils::PolylineInterpolation > tNeuronSections;
+
+    const MorphologyGeometry* _morphology( unsigned int gid ) const;
+
+    const tNeuronSections* _neuronSections( unsigned int index ) const;
+
+    void _flatten( nsol::NeuronMorphologyPtr morphology ,
+                   MorphologyGeometry& geometry ) const;
+
+    //! Douglas-Peucker over the points, marking the ones to keep.
+    void _simplify( const std::vector< vec3 >& points ,
+                    std::vector< bool >& keep ) const;
+
+    std::unique_ptr< tNeuronSections >
+    _transform( const MorphologyGeometry& geometry ,
+                const mat4& transform ) const;
+
+    nsol::DataSet* _dataset;
+
+    float _tolerance;
+
+    std::unordered_map< nsol::NeuronMorphologyPtr ,
+      MorphologyGeometry > _morphologies;
+
+    //! Neuron indices by gid, offset by the lowest gid of the dataset.
+    unsigned int _firstGid;
+    std::vector< unsigned int > _neuronIndices;
+
+    //! Per neuron tables, by neuron index.
+    std::vector< mat4 , Eigen::aligned_allocator< mat4 >> _transforms;
+    std::vector< const MorphologyGeometry* > _neuronMorphologies;
+
+    //! Sections of the neurons already requested, in their own space.
+    mutable std::vector< std::unique_ptr< tNeuronSections >> _neurons;
+
+    mutable std::mutex _neuronsMutex;
+  };
+}
+
+#endif /* SRC_SECTIONGEOMETRYSTORE_H_ */
@@ -0,0 +1,168 @@
+/*
+ * @file  SectionTable.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#include "SectionTable.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace syncopa
+{
+  const unsigned int SectionTable::invalidIndex =
+    std::numeric_limits< unsigned int >::max( );
+
+  SectionTable::SectionTable( void )
+    : _synapseOffsets( 1 , 0 )
+  { }
+
+  void SectionTable::clear( void )
+  {
+    _indices.clear( );
+    _sections.clear( );
+    _synapseOffsets.assign( 1 , 0 );
+    _synapses.clear( );
+    _pendingSections.clear( );
+    _pendingSynapses.clear( );
+    _cutOffsets.clear( );
+    _cutSizes.clear( );
+    _cutNodes.clear( );
+  }
+
+  unsigned int SectionTable::add( nsolMSection_ptr section )
+  {
+    auto it = _indices.find( section );
+    if ( it != _indices.end( ))
+      return it->second;
+
+    const auto index = static_cast< unsigned int >( _sections.size( ));
+    _indices.insert( std::make_pair( section , index ));
+    _sections.push_back( section );
+    _synapseOffsets.push_back( _synapseOffsets.back( ));
+    _cutOffsets.push_back( 0 );
+    _cutSizes.push_back( 0 );
+
+    return index;
+  }
+
+  void SectionTable::addSynapse( unsigned int index ,
+                                 const SectionSynapse& synapse )
+  {
+    _pendingSections.push_back( index );
+    _pendingSynapses.push_back( synapse );
+  }
+
+  void SectionTable::finalize( void )
+  {
+    if ( _pendingSynapses.empty( ))
+      return;
+
+    const size_t sectionCount = _sections.size( );
+
+    std::vector< unsigned int > counts( sectionCount , 0 );
+    for ( size_t i = 0; i < sectionCount; ++i )
+      counts[ i ] = _synapseOffsets[ i + 1 ] - _synapseOffsets[ i ];
+    for ( const auto section: _pendingSections )
+      ++counts[ section ];
+
+    // Stable counting sort of the old and new synapses by section.
+    std::vector< unsigned int > offsets( sectionCount + 1 , 0 );
+    for ( size_t i = 0; i < sectionCount; ++i )
+      offsets[ i + 1 ] = offsets[ i ] + counts[ i ];
+
+    std::vector< SectionSynapse > synapses( offsets.back( ));
+    std::vector< unsigned int > next( offsets.begin( ) , offsets.end( ) - 1 );
+
+    for ( size_t i = 0; i < sectionCount; ++i )
+    {
+      for ( auto j = _synapseOffsets[ i ]; j < _synapseOffsets[ i + 1 ]; ++j )
+        synapses[ next[ i ]++ ] = _synapses[ j ];
+    }
+
+    for ( size_t i = 0; i < _pendingSynapses.size( ); ++i )
+      synapses[ next[ _pendingSections[ i ]]++ ] = _pendingSynapses[ i ];
+
+    for ( size_t i = 0; i < sectionCount; ++i )
+    {
+      std::stable_sort( synapses.begin( ) + offsets[ i ] ,
+                        synapses.begin( ) + offsets[ i + 1 ] ,
+                        []( const SectionSynapse& a , const SectionSynapse& b )
+                        {
+                          return a.distance < b.distance;
+                        });
+    }
+
+    _synapses.swap( synapses );
+    _synapseOffsets.swap( offsets );
+
+    _pendingSections.clear( );
+    _pendingSynapses.clear( );
+  }
+
+  unsigned int SectionTable::find( nsolMSection_ptr section ) const
+  {
+    auto it = _indices.find( section );
+    if ( it == _indices.end( ))
+      return invalidIndex;
+
+    return it->second;
+  }
+
+  size_t SectionTable::size( void ) const
+  {
+    return _sections.size( );
+  }
+
+  nsolMSection_ptr SectionTable::section( unsigned int index ) const
+  {
+    return _sections[ index ];
+  }
+
+  SectionTableRange< SectionSynapse >
+  SectionTable::synapses( unsigned int index ) const
+  {
+    if ( index >= _sections.size( ))
+      return SectionTableRange< SectionSynapse >( nullptr , nullptr );
+
+    const auto data = _synapses.data( );
+    return SectionTableRange< SectionSynapse >(
+      data + _synapseOffsets[ index ] , data + _synapseOffsets[ index + 1 ] );
+  }
+
+  void SectionTable::cut( unsigned int index ,
+                          const utils::PolylineInterpolation& path ,
+                          const SectionSynapse& synapse )
+  {
+    if ( index >= _sections.size( ) || synapse.segment >= path.size( ))
+      return;
+
+    const auto& positions = path.positions( );
+
+    _cutOffsets[ index ] = static_cast< unsigned int >( _cutNodes.size( ));
+    _cutSizes[ index ] = synapse.segment + 2;
+
+    _cutNodes.insert( _cutNodes.end( ) , positions.begin( ) ,
+                      positions.begin( ) + synapse.segment + 1 );
+    _cutNodes.push_back( synapse.position );
+  }
+
+  bool SectionTable::isCut( unsigned int index ) const
+  {
+    return index < _sections.size( ) && _cutSizes[ index ] > 0;
+  }
+
+  SectionTableRange< vec3 > SectionTable::cutNodes( unsigned int index ) const
+  {
+    if ( !isCut( index ))
+      return SectionTableRange< vec3 >( nullptr , nullptr );
+
+    const auto data = _cutNodes.data( );
+    return SectionTableRange< vec3 >(
+      data + _cutOffsets[ index ] ,
+      data + _cutOffsets[ index ] + _cutSizes[ index ] );
+  }
+}
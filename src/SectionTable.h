@@ -0,0 +1,118 @@
+/*
+ * @file  SectionTable.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#ifndef SRC_SECTIONTABLE_H_
+#define SRC_SECTIONTABLE_H_
+
+#include "types.h"
+
+#include "PolylineInterpolation.hpp"
+
+namespace syncopa
+{
+  //! Synapse placed on a section of a SectionTable.
+  struct SectionSynapse
+  {
+    nsolMSynapse_ptr synapse;
+    TNeuronConnection type;
+    vec3 position;
+    //! Distance along the section.
+    float distance;
+    unsigned int segment;
+  };
+
+  //! View over contiguous elements of a SectionTable.
+  template< typename T >
+  class SectionTableRange
+  {
+  public:
+
+    SectionTableRange( const T* begin_ , const T* end_ )
+      : _begin( begin_ )
+      , _end( end_ )
+    { }
+
+    const T* begin( void ) const
+    { return _begin; }
+
+    const T* end( void ) const
+    { return _end; }
+
+    bool empty( void ) const
+    { return _begin == _end; }
+
+    size_t size( void ) const
+    { return static_cast< size_t >( _end - _begin ); }
+
+    const T& back( void ) const
+    { return *( _end - 1 ); }
+
+  protected:
+
+    const T* _begin;
+    const T* _end;
+  };
+
+  /*! Processed sections of a neuron, addressed by dense indices. After
+   * finalize( ), the synapses of each section are contiguous and sorted by
+   * their distance along the section. Cut sections store their nodes up to
+   * the farthest synapse. */
+  class SectionTable
+  {
+  public:
+
+    static const unsigned int invalidIndex;
+
+    SectionTable( void );
+
+    void clear( void );
+
+    //! Index of the section, adding it if needed.
+    unsigned int add( nsolMSection_ptr section );
+
+    void addSynapse( unsigned int index , const SectionSynapse& synapse );
+
+    //! Groups the synapses added so far by section and sorts them.
+    void finalize( void );
+
+    //! Index of the section, or invalidIndex.
+    unsigned int find( nsolMSection_ptr section ) const;
+
+    size_t size( void ) const;
+
+    nsolMSection_ptr section( unsigned int index ) const;
+
+    SectionTableRange< SectionSynapse > synapses( unsigned int index ) const;
+
+    //! Cuts the section path at the given synapse.
+    void cut( unsigned int index , const utils::PolylineInterpolation& path ,
+              const SectionSynapse& synapse );
+
+    bool isCut( unsigned int index ) const;
+
+    SectionTableRange< vec3 > cutNodes( unsigned int index ) const;
+
+  protected:
+
+    std::unordered_map< nsolMSection_ptr , unsigned int > _indices;
+    std::vector< nsolMSection_ptr > _sections;
+
+    std::vector< unsigned int > _synapseOffsets;
+    std::vector< SectionSynapse > _synapses;
+
+    //! Section of each synapse added since the last finalize( ).
+    std::vector< unsigned int > _pendingSections;
+    std::vector< SectionSynapse > _pendingSynapses;
+
+    std::vector< unsigned int > _cutOffsets;
+    std::vector< unsigned int > _cutSizes;
+    tPosVec _cutNodes;
+  };
+}
+
+#endif /* SRC_SECTIONTABLE_H_ */
@@ -0,0 +1,109 @@
+/*
+ * @file  SynapseIndex.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#include "SynapseIndex.h"
+
+#include <algorithm>
+
+namespace syncopa
+{
+  SynapseIndex::SynapseIndex( void )
+  { }
+
+  void SynapseIndex::build( const nsol::Synapses& synapses )
+  {
+    clear( );
+
+    tsynapseVec morphologySynapses;
+    morphologySynapses.reserve( synapses.size( ));
+
+    for ( auto synapse: synapses )
+    {
+      auto morphologySynapse = dynamic_cast< nsolMSynapse_ptr >( synapse );
+      if ( morphologySynapse )
+        morphologySynapses.push_back( morphologySynapse );
+    }
+
+    _buildRows( morphologySynapses , _presynaptic , PRESYNAPTIC );
+    _buildRows( morphologySynapses , _postsynaptic , POSTSYNAPTIC );
+  }
+
+  void SynapseIndex::clear( void )
+  {
+    _presynaptic = Rows( );
+    _postsynaptic = Rows( );
+  }
+
+  SynapseRange SynapseIndex::presynaptic( unsigned int gid ) const
+  {
+    return _row( _presynaptic , gid );
+  }
+
+  SynapseRange SynapseIndex::postsynaptic( unsigned int gid ) const
+  {
+    return _row( _postsynaptic , gid );
+  }
+
+  size_t SynapseIndex::size( void ) const
+  {
+    return _presynaptic.synapses.size( );
+  }
+
+  void SynapseIndex::_buildRows( const tsynapseVec& synapses , Rows& rows ,
+                                 TNeuronConnection type )
+  {
+    auto neuron = [ type ]( nsolMSynapse_ptr synapse )
+    {
+      return type == PRESYNAPTIC ? synapse->preSynapticNeuron( )
+                                 : synapse->postSynapticNeuron( );
+    };
+
+    gidVec neurons;
+    neurons.reserve( synapses.size( ));
+    for ( auto synapse: synapses )
+      neurons.push_back( neuron( synapse ));
+
+    rows.gids = neurons;
+    std::sort( rows.gids.begin( ) , rows.gids.end( ));
+    rows.gids.erase( std::unique( rows.gids.begin( ) , rows.gids.end( )) ,
+                     rows.gids.end( ));
+
+    // Counting sort on the row of each synapse, which keeps the circuit
+    // order inside every row.
+    std::vector< size_t > rowOf( synapses.size( ));
+    rows.offsets.assign( rows.gids.size( ) + 1 , 0 );
+    for ( size_t i = 0; i < synapses.size( ); ++i )
+    {
+      rowOf[ i ] = static_cast< size_t >(
+        std::lower_bound( rows.gids.begin( ) , rows.gids.end( ) ,
+                          neurons[ i ] ) - rows.gids.begin( ));
+      ++rows.offsets[ rowOf[ i ] + 1 ];
+    }
+
+    for ( size_t row = 0; row < rows.gids.size( ); ++row )
+      rows.offsets[ row + 1 ] += rows.offsets[ row ];
+
+    std::vector< size_t > next( rows.offsets.begin( ) ,
+                                rows.offsets.end( ) - 1 );
+    rows.synapses.resize( synapses.size( ));
+    for ( size_t i = 0; i < synapses.size( ); ++i )
+      rows.synapses[ next[ rowOf[ i ]]++ ] = synapses[ i ];
+  }
+
+  SynapseRange SynapseIndex::_row( const Rows& rows , unsigned int gid )
+  {
+    auto it = std::lower_bound( rows.gids.begin( ) , rows.gids.end( ) , gid );
+    if ( it == rows.gids.end( ) || *it != gid )
+      return SynapseRange( rows.synapses.end( ) , rows.synapses.end( ));
+
+    const size_t row = static_cast< size_t >( it - rows.gids.begin( ));
+
+    return SynapseRange( rows.synapses.begin( ) + rows.offsets[ row ] ,
+                         rows.synapses.begin( ) + rows.offsets[ row + 1 ] );
+  }
+}
@@ -0,0 +1,86 @@
+/*
+ * @file  SynapseIndex.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+#ifndef SRC_SYNAPSEINDEX_H_
+#define SRC_SYNAPSEINDEX_H_
+
+#include "types.h"
+
+namespace syncopa
+{
+  //! Contiguous range of synapses of a SynapseIndex.
+  class SynapseRange
+  {
+  public:
+
+    SynapseRange( tsynapseVec::const_iterator begin_ ,
+                  tsynapseVec::const_iterator end_ )
+      : _begin( begin_ )
+      , _end( end_ )
+    { }
+
+    tsynapseVec::const_iterator begin( void ) const
+    { return _begin; }
+
+    tsynapseVec::const_iterator end( void ) const
+    { return _end; }
+
+    bool empty( void ) const
+    { return _begin == _end; }
+
+    size_t size( void ) const
+    { return static_cast< size_t >( _end - _begin ); }
+
+  protected:
+
+    tsynapseVec::const_iterator _begin;
+    tsynapseVec::const_iterator _end;
+  };
+
+  /*! Morphology synapses of the circuit grouped by presynaptic and by
+   * postsynaptic neuron, in compressed sparse row layout. Synapses of each
+   * neuron are contiguous and keep the circuit order. */
+  class SynapseIndex
+  {
+  public:
+
+    SynapseIndex( void );
+
+    void build( const nsol::Synapses& synapses );
+
+    void clear( void );
+
+    //! Synapses with gid as presynaptic neuron.
+    SynapseRange presynaptic( unsigned int gid ) const;
+
+    //! Synapses with gid as postsynaptic neuron.
+    SynapseRange postsynaptic( unsigned int gid ) const;
+
+    size_t size( void ) const;
+
+  protected:
+
+    //! Rows of one of the two groupings.
+    struct Rows
+    {
+      gidVec gids;
+      std::vector< size_t > offsets;
+      tsynapseVec synapses;
+    };
+
+    static void _buildRows( const tsynapseVec& synapses , Rows& rows ,
+                            TNeuronConnection type );
+
+    static SynapseRange _row( const Rows& rows , unsigned int gid );
+
+    Rows _presynaptic;
+    Rows _postsynaptic;
+  };
+}
+
+#endif /* SRC_SYNAPSEINDEX_H_ */
@@ -0,0 +1,39 @@
+/*
+ * @file  DynamicPathSegment.cpp
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+
+#include <GL/glew.h>
+
+#include "DynamicPathSegment.h"
+
+void DynamicPathSegment::enableVAOAttributes( )
+{
+  glEnableVertexAttribArray( 1 );
+  glVertexAttribPointer( 1 , 3 , GL_FLOAT , GL_FALSE ,
+                         sizeof( DynamicPathSegment ) ,
+                         ( void* ) 0 );
+  glVertexAttribDivisor( 1 , 1 );
+
+  glEnableVertexAttribArray( 2 );
+  glVertexAttribPointer( 2 , 3 , GL_FLOAT , GL_FALSE ,
+                         sizeof( DynamicPathSegment ) ,
+                         ( void* ) ( sizeof( float ) * 3 ));
+  glVertexAttribDivisor( 2 , 1 );
+
+  glEnableVertexAttribArray( 3 );
+  glVertexAttribPointer( 3 , 2 , GL_FLOAT , GL_FALSE ,
+                         sizeof( DynamicPathSegment ) ,
+                         ( void* ) ( sizeof( float ) * 6 ));
+  glVertexAttribDivisor( 3 , 1 );
+
+  glEnableVertexAttribArray( 4 );
+  glVertexAttribPointer( 4 , 1 , GL_FLOAT , GL_FALSE ,
+                         sizeof( DynamicPathSegment ) ,
+                         ( void* ) ( sizeof( float ) * 8 ));
+  glVertexAttribDivisor( 4 , 1 );
+}
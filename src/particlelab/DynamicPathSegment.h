@@ -0,0 +1,32 @@
+/*
+ * @file  DynamicPathSegment.h
+ * @brief
+ * @author Sergio E. Galindo <sergio.galindo@urjc.es>
+ * @date
+ * @remarks Copyright (c) GMRV/URJC. All rights reserved.
+ *          Do not distribute without further notice.
+ */
+
+#ifndef SYNCOPA_DYNAMICPATHSEGMENT_H
+#define SYNCOPA_DYNAMICPATHSEGMENT_H
+
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+/*! Segment of a dynamic path, crossed by the wavefront between both
+ * times. The pulse is placed along it by the vertex shader. */
+struct DynamicPathSegment
+{
+
+  glm::vec3 start;
+  glm::vec3 end;
+  glm::vec2 times;
+  float isPostsynaptic;
+
+  static void enableVAOAttributes( );
+
+};
+
+
+#endif //SYNCOPA_DYNAMICPATHSEGMENT_H
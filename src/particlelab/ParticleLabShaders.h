@@ -155,6 +155,73 @@ void main()
     size = pSize;
 })";
 
+const static std::string DYNAMIC_SEGMENT_VERTEX_SHADER = R"(#version 430
+uniform mat4 viewProjectionMatrix;
+uniform vec3 cameraUp;
+uniform vec3 cameraRight;
+
+uniform float particlePreSize;
+uniform float particlePostSize;
+uniform vec4 particlePreColor;
+uniform vec4 particlePostColor;
+uniform float particlePreVisibility;
+uniform float particlePostVisibility;
+
+uniform float timestamp;
+uniform float pulseDuration;
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec3 segmentStart;
+layout(location = 2) in vec3 segmentEnd;
+layout(location = 3) in vec2 segmentTimes;
+layout(location = 4) in float isPostsynaptic;
+
+flat out vec4 color;
+out vec2 uvCoord;
+out float size;
+
+void main()
+{
+    // Part of the segment crossed during the last pulse.
+    float tailTime = max(segmentTimes.x, timestamp - pulseDuration);
+    float headTime = min(segmentTimes.y, timestamp);
+
+    float pulseActive = float(headTime > tailTime);
+
+    float pointTime = mix(tailTime, headTime, vertex.x + 0.5);
+    float duration = max(segmentTimes.y - segmentTimes.x, 1e-6);
+    vec3 position = mix(segmentStart, segmentEnd,
+    (pointTime - segmentTimes.x) / duration);
+
+    float pSize = pulseActive *
+    (isPostsynaptic * particlePostSize * particlePostVisibility
+    + (1 - isPostsynaptic) * particlePreSize * particlePreVisibility);
+
+    color = isPostsynaptic * particlePostColor + (1 - isPostsynaptic) * particlePreColor;
+    color.a *= pulseActive;
+
+    // Width across the segment, facing the camera.
+    vec3 direction = segmentEnd - segmentStart;
+    vec2 screenDirection = vec2(dot(direction, cameraRight),
+    dot(direction, cameraUp));
+    vec3 side = cameraUp;
+    if (length(screenDirection) > 0.0)
+    {
+        screenDirection = normalize(screenDirection);
+        side = -screenDirection.y * cameraRight + screenDirection.x * cameraUp;
+    }
+
+    gl_Position = viewProjectionMatrix
+    * vec4((vertex.y * pSize * side) + position, 1.0f)
+    - vec4(0.0f, 0.0f, 0.1f, 0.0f);
+
+    // The radial falloff of the fragment shader fades the trail with age,
+    // as the alpha of the particles left behind by the pulse.
+    uvCoord = vec2(0.5f + 0.5f * (timestamp - pointTime) / pulseDuration,
+    vertex.y + 0.5f);
+    size = pSize;
+})";
+
 const static std::string PARTICLE_FRAGMENT_SHADER = R"(#version 430
 flat in vec4 color;
 in vec2 uvCoord;